@@ -0,0 +1,347 @@
+///
+/// @file	 coapBench.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-16
+/// @brief	 Host benchmark of the picocoap codec
+///
+/// @details Runs the parse and build functions of coap.c over a corpus of the messages
+///          this project sends and receives, and prints one JSON object per line:
+///          messages per second, ns per operation and bytes allocated per operation.
+///          coap.c is compiled with malloc/calloc/realloc/free mapped to the counting
+///          versions below, so any allocation by the codec shows up in the results.
+///          See readme.txt for the build line.
+///
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../coap.h"
+
+#define MSG_LEN			128
+#define MIN_TIME_NS		200000000ULL	//every benchmark runs at least 0.2 s
+
+typedef struct bench_msg {
+	const char *name;
+	uint8_t buf[MSG_LEN];
+	size_t len;
+} bench_msg;
+
+typedef struct bench_opt {
+	uint16_t num;
+	const uint8_t *val;
+	uint16_t len;
+} bench_opt;
+
+static bench_msg corpus[4];
+static volatile size_t sink;
+static size_t allocated;
+static const char *revision = "";
+
+
+//Allocation counters of coap.c (-Dmalloc=bench_malloc ...)
+void *bench_malloc(size_t size)
+{
+	allocated += size;
+	return malloc(size);
+}
+
+void *bench_calloc(size_t n, size_t size)
+{
+	allocated += n * size;
+	return calloc(n, size);
+}
+
+void *bench_realloc(void *ptr, size_t size)
+{
+	allocated += size;
+	return realloc(ptr, size);
+}
+
+void bench_free(void *ptr)
+{
+	free(ptr);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+//
+// Corpus
+//
+
+static const uint8_t series_payload[22] = {
+	0x14, 0x00, 0x5D, 0xC0, 0x00, 0x1C, 0x00, 0x84, 0x01, 0x00, 0x20,
+	0x08, 0x00, 0x40, 0x10, 0x02, 0x00, 0x80, 0x20, 0x04, 0x01, 0x00
+};
+static const uint8_t block_payload[64] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+//Telemetry uplink: NON PUT /temp, the compressed sample batch
+static const bench_opt telemetry_opts[] = {
+	{CON_URI_PATH, (const uint8_t*)"temp", 4},
+	{CON_CONTENT_FORMATt, (const uint8_t*)"\x2A", 1},
+};
+
+//Observe notification of /sensors/temp
+static const bench_opt notify_opts[] = {
+	{CON_ETAG, (const uint8_t*)"\xA1\x5C", 2},
+	{CON_OBSERVE, (const uint8_t*)"\x01\x2C", 2},
+	{CON_CONTENT_FORMATt, (const uint8_t*)"", 0},
+	{CON_MAX_AGE, (const uint8_t*)"\x04\xB0", 2},
+};
+
+//Block2 response, block 5 of 64 bytes, more blocks follow
+static const bench_opt block_opts[] = {
+	{CON_ETAG, (const uint8_t*)"\x3E\x01\x77\x10", 4},
+	{CON_CONTENT_FORMATt, (const uint8_t*)"\x2A", 1},
+	{CON_BLOCK2, (const uint8_t*)"\x5A", 1},
+	{CON_SIZE2, (const uint8_t*)"\x04\x00", 2},
+};
+
+//Request with many options, as the HTTP-CoAP proxy sends them
+static const bench_opt request_opts[] = {
+	{CON_URI_PATH, (const uint8_t*)"sensors", 7},
+	{CON_URI_PATH, (const uint8_t*)"temp", 4},
+	{CON_URI_PATH, (const uint8_t*)"history", 7},
+	{CON_URI_QUERY, (const uint8_t*)"n=20", 4},
+	{CON_URI_QUERY, (const uint8_t*)"unit=Cel", 8},
+	{CON_ACCEPT, (const uint8_t*)"\x70", 1},
+	{CON_BLOCK2, (const uint8_t*)"\x02", 1},
+};
+
+struct corpus_def {
+	const char *name;
+	coap_type type;
+	coap_code code;
+	uint8_t tkl;
+	const bench_opt *opts;
+	uint8_t count;
+	const uint8_t *payload;
+	size_t payload_len;
+};
+
+static const struct corpus_def corpus_defs[] = {
+	{"telemetry", CT_NON, CC_PUT, 0, telemetry_opts, 2, series_payload, sizeof(series_payload)},
+	{"notify", CT_NON, CC_CONTENT, 4, notify_opts, 4, (const uint8_t*)"28", 2},
+	{"block2", CT_ACK, CC_CONTENT, 4, block_opts, 4, block_payload, sizeof(block_payload)},
+	{"request", CT_CON, CC_GET, 4, request_opts, 7, NULL, 0},
+};
+
+//Builds a message with coap_add_option, in order or in reverse order
+static size_t build_add_option(const struct corpus_def *d, uint8_t *buf, uint8_t reverse)
+{
+	coap_pdu pdu = {buf, 0, MSG_LEN, NULL};
+	uint8_t start, end, k;
+
+	coap_init_pdu(&pdu);
+	coap_set_type(&pdu, d->type);
+	coap_set_code(&pdu, d->code);
+	coap_set_mid(&pdu, 0x1234);
+	coap_set_token(&pdu, 0xC0FFEE42, d->tkl);
+	if(!reverse){
+		for(k = 0; k < d->count; k++){
+			coap_add_option(&pdu, d->opts[k].num, (uint8_t*)d->opts[k].val, d->opts[k].len);
+		}
+	}
+	else{
+		//Highest number first, options with the same number keep their order
+		for(end = d->count; end > 0; end = start){
+			for(start = end - 1; start > 0 && d->opts[start - 1].num == d->opts[end - 1].num; start--);
+			for(k = start; k < end; k++){
+				coap_add_option(&pdu, d->opts[k].num, (uint8_t*)d->opts[k].val, d->opts[k].len);
+			}
+		}
+	}
+	if(d->payload_len != 0){
+		coap_set_payload(&pdu, (uint8_t*)d->payload, d->payload_len);
+	}
+	return pdu.len;
+}
+
+//Builds a message with the builder, the path the device uses
+static size_t build_builder(const struct corpus_def *d, uint8_t *buf)
+{
+	coap_pdu pdu = {buf, 0, MSG_LEN, NULL};
+	coap_builder b;
+	uint8_t i;
+
+	coap_builder_init(&b, &pdu, d->type, d->code, 0x1234, 0xC0FFEE42, d->tkl);
+	for(i = 0; i < d->count; i++){
+		coap_builder_add_option(&b, d->opts[i].num, d->opts[i].val, d->opts[i].len);
+	}
+	if(d->payload_len != 0){
+		coap_builder_set_payload(&b, d->payload, d->payload_len);
+	}
+	coap_builder_finish(&b);
+	return pdu.len;
+}
+
+static void corpus_init(void)
+{
+	uint8_t i;
+
+	for(i = 0; i < sizeof(corpus_defs) / sizeof(corpus_defs[0]); i++){
+		corpus[i].name = corpus_defs[i].name;
+		corpus[i].len = build_builder(&corpus_defs[i], corpus[i].buf);
+	}
+}
+
+
+//
+// Benchmarks, every call is one operation on one message
+//
+
+static void op_validate(bench_msg *m)
+{
+	coap_pdu pdu = {m->buf, m->len, MSG_LEN, NULL};
+
+	sink += coap_validate_pkt(&pdu);
+}
+
+static void op_validate_index(bench_msg *m)
+{
+	coap_option_index idx;
+	coap_pdu pdu = {m->buf, m->len, MSG_LEN, &idx};
+
+	sink += coap_validate_pkt(&pdu) + idx.count;
+}
+
+static void op_get_option(bench_msg *m)
+{
+	coap_pdu pdu = {m->buf, m->len, MSG_LEN, NULL};
+	coap_option option = coap_get_option(&pdu, NULL);
+
+	while(option.num != 0){
+		sink += option.len;
+		option = coap_get_option(&pdu, &option);
+	}
+}
+
+static void op_get_option_by_num(bench_msg *m)
+{
+	coap_pdu pdu = {m->buf, m->len, MSG_LEN, NULL};
+
+	sink += coap_get_option_by_num(&pdu, CON_CONTENT_FORMATt, 0).len;
+	sink += coap_get_option_by_num(&pdu, CON_BLOCK2, 0).len;
+}
+
+static coap_option_index bench_idx;
+
+static void op_get_option_by_num_index(bench_msg *m)
+{
+	coap_pdu pdu = {m->buf, m->len, MSG_LEN, &bench_idx};
+
+	sink += coap_get_option_by_num(&pdu, CON_CONTENT_FORMATt, 0).len;
+	sink += coap_get_option_by_num(&pdu, CON_BLOCK2, 0).len;
+}
+
+static void op_add_option(bench_msg *m)
+{
+	uint8_t buf[MSG_LEN];
+
+	sink += build_add_option(&corpus_defs[m - corpus], buf, 0);
+}
+
+static void op_add_option_reverse(bench_msg *m)
+{
+	uint8_t buf[MSG_LEN];
+
+	sink += build_add_option(&corpus_defs[m - corpus], buf, 1);
+}
+
+//Sets the payload of the message without it
+static void op_set_payload(bench_msg *m)
+{
+	const struct corpus_def *d = &corpus_defs[m - corpus];
+	uint8_t buf[MSG_LEN];
+	coap_pdu pdu = {buf, m->len - d->payload_len - 1, MSG_LEN, NULL};
+
+	memcpy(buf, m->buf, pdu.len);
+	coap_set_payload(&pdu, (uint8_t*)d->payload, d->payload_len);
+	sink += pdu.len;
+}
+
+static void op_builder(bench_msg *m)
+{
+	uint8_t buf[MSG_LEN];
+
+	sink += build_builder(&corpus_defs[m - corpus], buf);
+}
+
+static void run(const char *bench, void (*op)(bench_msg *m), bench_msg *m)
+{
+	uint64_t iterations = 1000, i, start, elapsed;
+	size_t bytes;
+
+	//Warm up, and check that the operation does not fail on this message
+	op(m);
+
+	//Double the iterations until the run is long enough to time
+	while(1){
+		allocated = 0;
+		start = now_ns();
+		for(i = 0; i < iterations; i++){
+			op(m);
+		}
+		elapsed = now_ns() - start;
+		if(elapsed >= MIN_TIME_NS){
+			break;
+		}
+		iterations *= 2;
+	}
+	bytes = allocated;
+
+	printf("{\"suite\":\"picocoap\",\"rev\":\"%s\",\"bench\":\"%s\",\"msg\":\"%s\",\"msg_len\":%u,"
+			"\"iterations\":%llu,\"ns_per_op\":%.2f,\"msgs_per_s\":%.0f,\"bytes_allocated_per_op\":%.2f}\n",
+			revision, bench, m->name, (unsigned)m->len, (unsigned long long)iterations,
+			(double)elapsed / iterations, iterations * 1e9 / elapsed, (double)bytes / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t buf[MSG_LEN];
+	coap_pdu pdu;
+	uint8_t i;
+
+	//The revision is copied into every result, e.g. ./coapBench $(git rev-parse --short HEAD)
+	if(argc > 1){
+		revision = argv[1];
+	}
+	corpus_init();
+
+	for(i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i++){
+		pdu.buf = corpus[i].buf;
+		pdu.len = corpus[i].len;
+		pdu.max = MSG_LEN;
+		pdu.idx = &bench_idx;
+		if(coap_validate_pkt(&pdu) != CE_NONE){
+			fprintf(stderr, "corpus message %s is not valid\n", corpus[i].name);
+			return 1;
+		}
+		//Every way of building gives the same message
+		if(build_add_option(&corpus_defs[i], buf, 0) != corpus[i].len || memcmp(buf, corpus[i].buf, corpus[i].len) != 0 ||
+				build_add_option(&corpus_defs[i], buf, 1) != corpus[i].len || memcmp(buf, corpus[i].buf, corpus[i].len) != 0){
+			fprintf(stderr, "coap_add_option builds a different %s message\n", corpus[i].name);
+			return 1;
+		}
+
+		run("validate", op_validate, &corpus[i]);
+		run("validate_index", op_validate_index, &corpus[i]);
+		run("get_option", op_get_option, &corpus[i]);
+		run("get_option_by_num", op_get_option_by_num, &corpus[i]);
+		run("get_option_by_num_index", op_get_option_by_num_index, &corpus[i]);
+		run("add_option", op_add_option, &corpus[i]);
+		run("add_option_out_of_order", op_add_option_reverse, &corpus[i]);
+		if(corpus_defs[i].payload_len != 0){
+			run("set_payload", op_set_payload, &corpus[i]);
+		}
+		run("builder", op_builder, &corpus[i]);
+	}
+	return 0;
+}
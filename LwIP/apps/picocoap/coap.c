@@ -10,10 +10,16 @@
 
 coap_error coap_validate_pkt(coap_pdu *pdu) //uint8_t *pkt, size_t pkt_len)
 {
+	coap_option_index *idx = pdu->idx;
 	coap_error err;
+	uint16_t num;
+	uint8_t count;
 	size_t ol;
 	uint8_t *ov;
 
+	if (idx != NULL)
+		idx->count = COAP_INDEX_STALE;
+
 	if (pdu->len > pdu->max)
 		return CE_INVALID_PACKET;
 
@@ -25,29 +31,50 @@ coap_error coap_validate_pkt(coap_pdu *pdu) //uint8_t *pkt, size_t pkt_len)
 		return CE_INVALID_PACKET;
 
 	// Check TKL
-	if (coap_get_tkl(pdu) > 8)
+	if (coap_get_tkl(pdu) > 8 || pdu->len < 4 + coap_get_tkl(pdu))
 		return CE_INVALID_PACKET;
 
-	// Check Options
+	// Check Options, and index them in the same pass
 	ov = pdu->buf + 4 + coap_get_tkl(pdu);
 	ol = 0;
-	while((err = coap_decode_option(ov + ol, pdu->len-(ov-pdu->buf), NULL, &ol, &ov)) != 0){
-		if (err == CE_NONE){
-			continue;
-		} else if (err == CE_END_OF_PACKET){
+	num = 0;
+	count = 0;
+	if (idx != NULL)
+		idx->payload = 0;
+
+	while (1){
+		err = coap_decode_option(ov + ol, pdu->len-(ov + ol - pdu->buf), &num, &ol, &ov);
+		if (err == CE_END_OF_PACKET){
 			break;
 		} else if (err == CE_FOUND_PAYLOAD_MARKER){
 			// Payload Marker, but No Payload
-			if (pdu->len == (ov + ol - pdu->buf)){
+			if (pdu->len == (ov + ol + 1 - pdu->buf)){
 				return CE_INVALID_PACKET;
-			} else {
-				break;
 			}
-		} else {
+			if (idx != NULL)
+				idx->payload = ov + ol + 1 - pdu->buf;
+			break;
+		} else if (err != CE_NONE){
 			return err;
 		}
+
+		// Option Value Outside of the Packet
+		if (ov + ol > pdu->buf + pdu->len)
+			return CE_INVALID_PACKET;
+
+		if (idx != NULL && count < COAP_INDEX_MAX_OPTIONS){
+			idx->opt[count].num = num;
+			idx->opt[count].offset = ov - pdu->buf;
+			idx->opt[count].len = ol;
+		}
+		if (count < 0xFF)
+			count++;
 	}
 
+	// Too many options to index: the getters parse the message
+	if (idx != NULL && count <= COAP_INDEX_MAX_OPTIONS)
+		idx->count = count;
+
 	return CE_NONE;
 }
 
@@ -120,11 +147,35 @@ coap_option coap_get_option(coap_pdu *pdu, coap_option *last)
 
 coap_option coap_get_option_by_num(coap_pdu *pdu, coap_option_number num, uint8_t occ)
 {
+	coap_option_index *idx = pdu->idx;
 	coap_option option;
-	uint8_t i = 0;
+	uint8_t i = 0, lo, hi, mid;
 
 	option.num = 0;
 
+	if (idx != NULL && idx->count != COAP_INDEX_STALE){
+		// Binary search for the first option with this number
+		lo = 0;
+		hi = idx->count;
+		while (lo < hi){
+			mid = (lo + hi) / 2;
+			if (idx->opt[mid].num < num)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (lo + occ < idx->count && idx->opt[lo + occ].num == num){
+			option.num = num;
+			option.len = idx->opt[lo + occ].len;
+			option.val = pdu->buf + idx->opt[lo + occ].offset;
+		} else {
+			option.len = 0;
+			option.val = NULL;
+		}
+		return option;
+	}
+
 	do {
 		option = coap_get_option(pdu, &option);
 
@@ -220,6 +271,14 @@ coap_payload coap_get_payload(coap_pdu *pdu)
 	payload.len = 0;
 	payload.val = NULL;
 
+	if (pdu->idx != NULL && pdu->idx->count != COAP_INDEX_STALE){
+		if (pdu->idx->payload != 0){
+			payload.len = pdu->len - pdu->idx->payload;
+			payload.val = pdu->buf + pdu->idx->payload;
+		}
+		return payload;
+	}
+
 	// Find Last Option
 	do {
 		err = coap_decode_option(pdu->buf+offset, pdu->len-offset, NULL, &option.len, &option.val);
@@ -246,12 +305,21 @@ coap_payload coap_get_payload(coap_pdu *pdu)
 // Setters
 //
 
+// The options move, the index no longer matches the message.
+static inline void coap_index_stale(coap_pdu *pdu)
+{
+	if (pdu->idx != NULL)
+		pdu->idx->count = COAP_INDEX_STALE;
+}
+
 coap_error coap_init_pdu(coap_pdu *pdu)
 {
 	// Check that we were given enough packet.
 	if (pdu->max < 4)
 		return CE_INSUFFICIENT_BUFFER;
 
+	coap_index_stale(pdu);
+
 	pdu->len = 0;
 	memset(pdu->buf, 0, 4);
 
@@ -327,6 +395,8 @@ coap_error coap_set_token(coap_pdu *pdu, uint64_t token, uint8_t tkl)
 	if (pdu->max < 4 + tkl)
 		return CE_INSUFFICIENT_BUFFER;
 
+	coap_index_stale(pdu);
+
 	// Check token length for spec.
 	if (tkl > 8)
 		return CE_INVALID_PACKET;
@@ -358,6 +428,8 @@ coap_error coap_add_option(coap_pdu *pdu, int32_t opt_num, uint8_t* value, uint1
 	size_t fopt_len, opts_len;
 	coap_error err;
 
+	coap_index_stale(pdu);
+
 	// Set pointer to "zeroth option's value" which is really first option header.
 	fopt_val = pdu->buf + 4 + coap_get_tkl(pdu); // ptr to start of options
 	fopt_len = 0;
@@ -419,6 +491,8 @@ coap_error coap_set_payload(coap_pdu *pdu, uint8_t *payload, size_t payload_len)
 	size_t fopt_len;
 	coap_error err;
 
+	coap_index_stale(pdu);
+
 	// Set pointer to "zeroth option's value" which is really first option header.
 	fopt_val = pdu->buf + 4 + coap_get_tkl(pdu);
 	fopt_len = 0;
@@ -453,6 +527,154 @@ coap_error coap_set_payload(coap_pdu *pdu, uint8_t *payload, size_t payload_len)
 	return CE_NONE;
 }
 
+//
+// Builder
+//
+
+coap_error coap_builder_init(coap_builder *b, coap_pdu *pdu, coap_type mtype, coap_code code,
+                             uint16_t mid, uint64_t token, uint8_t tkl)
+{
+	b->pdu = pdu;
+	b->err = CE_NONE;
+	b->count = 0;
+	b->payload = NULL;
+	b->payload_len = 0;
+
+	// Check token length for spec.
+	if (tkl > 8)
+		b->err = CE_INVALID_PACKET;
+
+	// Check that we were given enough buffer.
+	if (pdu->max < 4 + tkl)
+		b->err = CE_INSUFFICIENT_BUFFER;
+
+	if (b->err != CE_NONE)
+		return b->err;
+
+	coap_index_stale(pdu);
+
+	// The header and the token have a fixed place, write them now.
+	pdu->buf[0] = (COAP_V1 << 6) | (mtype << 4) | tkl;
+	pdu->buf[1] = code;
+	pdu->buf[2] = mid >> 8;
+	pdu->buf[3] = mid & 0xFF;
+	memcpy(pdu->buf + 4, &token, tkl);
+	pdu->len = 4 + tkl;
+
+	return CE_NONE;
+}
+
+// Makes room for an option in the sorted staging array, after the options with the same number.
+static coap_error coap_builder_insert(coap_builder *b, uint16_t num, uint16_t len, uint8_t *slot)
+{
+	uint8_t i;
+
+	if (b->count >= COAP_BUILDER_MAX_OPTIONS){
+		if (b->err == CE_NONE)
+			b->err = CE_INSUFFICIENT_BUFFER;
+		return CE_INSUFFICIENT_BUFFER;
+	}
+
+	i = b->count++;
+	while (i > 0 && b->opt[i-1].num > num){
+		b->opt[i] = b->opt[i-1];
+		// An integer value moves with its option.
+		if (b->opt[i].val == b->opt[i-1].uint_val)
+			b->opt[i].val = b->opt[i].uint_val;
+		i--;
+	}
+
+	b->opt[i].num = num;
+	b->opt[i].len = len;
+	*slot = i;
+
+	return CE_NONE;
+}
+
+coap_error coap_builder_add_option(coap_builder *b, uint16_t num, const uint8_t *val, uint16_t len)
+{
+	coap_error err;
+	uint8_t i;
+
+	err = coap_builder_insert(b, num, len, &i);
+	if (err != CE_NONE)
+		return err;
+
+	b->opt[i].val = val;
+
+	return CE_NONE;
+}
+
+coap_error coap_builder_add_uint_option(coap_builder *b, uint16_t num, uint32_t value)
+{
+	coap_error err;
+	uint8_t len = 0, i, j;
+
+	while (len < 4 && (value >> (8 * len)))
+		len++;
+
+	err = coap_builder_insert(b, num, len, &i);
+	if (err != CE_NONE)
+		return err;
+
+	for (j = 0; j < len; j++)
+		b->opt[i].uint_val[j] = value >> (8 * (len - 1 - j));
+	b->opt[i].val = b->opt[i].uint_val;
+
+	return CE_NONE;
+}
+
+coap_error coap_builder_set_payload(coap_builder *b, const uint8_t *payload, size_t len)
+{
+	b->payload = payload;
+	b->payload_len = len;
+
+	return CE_NONE;
+}
+
+coap_error coap_builder_finish(coap_builder *b)
+{
+	coap_pdu *pdu = b->pdu;
+	uint8_t *ptr;
+	uint16_t last = 0;
+	size_t len;
+	uint8_t i;
+
+	if (b->err != CE_NONE)
+		return b->err;
+
+	// Total length first, so that nothing is written when it does not fit.
+	len = pdu->len;
+	for (i = 0; i < b->count; i++){
+		len += coap_compute_option_header_len(b->opt[i].num - last, b->opt[i].len) + b->opt[i].len;
+		last = b->opt[i].num;
+	}
+	if (b->payload_len != 0)
+		len += 1 + b->payload_len;
+
+	if (pdu->max < len)
+		return CE_INSUFFICIENT_BUFFER;
+
+	// Options and payload in one pass.
+	ptr = pdu->buf + pdu->len;
+	last = 0;
+	for (i = 0; i < b->count; i++){
+		ptr += coap_build_option_header(ptr, pdu->buf + pdu->max - ptr, b->opt[i].num - last, b->opt[i].len);
+		memcpy(ptr, b->opt[i].val, b->opt[i].len);
+		ptr += b->opt[i].len;
+		last = b->opt[i].num;
+	}
+	if (b->payload_len != 0){
+		*(ptr++) = 0xFF;
+		memcpy(ptr, b->payload, b->payload_len);
+		ptr += b->payload_len;
+	}
+
+	pdu->len = ptr - pdu->buf;
+
+	return CE_NONE;
+}
+
 coap_error coap_adjust_option_deltas(uint8_t *opts_start, size_t *opts_len, size_t max_len, int32_t offset)
 {
 	uint8_t *ptr, *fopt_val;
@@ -491,7 +713,8 @@ coap_error coap_adjust_option_deltas(uint8_t *opts_start, size_t *opts_len, size
 			if (max_len < *opts_len + (nhdr_len - fhdr_len))
 				return CE_INSUFFICIENT_BUFFER;
 
-			memmove(fopt_val + (nhdr_len - fhdr_len), fopt_val, fopt_len);
+			// The value and everything after it (other options, payload) moves.
+			memmove(fopt_val + (nhdr_len - fhdr_len), fopt_val, *opts_len - (fopt_val - opts_start));
 
 			// Adjust Options Length
 			*opts_len += (nhdr_len - fhdr_len);
@@ -500,6 +723,9 @@ coap_error coap_adjust_option_deltas(uint8_t *opts_start, size_t *opts_len, size
 		// Write New Header
 		nhdr_len = coap_build_option_header(ptr, nhdr_len, nopt_num, fopt_len);
 
+		// The deltas of the options after it are relative to this one and do not change.
+		break;
+
 	}while (1);
 
 	return CE_NONE;
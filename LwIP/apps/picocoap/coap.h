@@ -133,11 +133,43 @@ typedef enum coap_option_number {
 	CON_URI_QUERY = 15,
 	CON_ACCEPT = 17,
 	CON_LOCATION_QUERY = 20,
+	CON_BLOCK2 = 23,
+	CON_BLOCK1 = 27,
+	CON_SIZE2 = 28,
 	CON_PROXY_URI = 35,
 	CON_PROXY_SCHEME = 39,
-	CON_SIZE1 = 60
+	CON_SIZE1 = 60,
+	CON_NO_RESPONSE = 258
 } coap_option_number;
 
+///
+/// Options in the Option Index
+///
+/// A message with more options is not indexed, the getters then parse the message.
+///
+#ifndef COAP_INDEX_MAX_OPTIONS
+#define COAP_INDEX_MAX_OPTIONS 8
+#endif
+
+///
+/// Option Index
+///
+/// Number, offset and length of every option, built by coap_validate_pkt in the
+/// same pass that checks the options. The options of a valid message are sorted
+/// by number, so an option is found with a binary search.
+///
+typedef struct coap_option_index {
+	uint8_t count;		/// number of options, COAP_INDEX_STALE when not usable
+	uint16_t payload;	/// offset of the payload, 0 when there is none
+	struct {
+		uint16_t num;	/// option number
+		uint16_t offset;/// offset of the value in the message
+		uint16_t len;	/// length of the value
+	} opt[COAP_INDEX_MAX_OPTIONS];
+} coap_option_index;
+
+#define COAP_INDEX_STALE 0xFF
+
 ///
 /// Packet Data Unit
 ///
@@ -147,6 +179,7 @@ typedef struct coap_pdu {
 	uint8_t *buf;  /// pointer to buffer
 	size_t len;	   /// length of current message
 	size_t max;	   /// size of buffer
+	coap_option_index *idx;	/// option index filled by coap_validate_pkt, can be NULL
 } coap_pdu;
 
 ///
@@ -178,6 +211,8 @@ typedef struct coap_payload {
 /// This function (or coap_init_pdu for creating new packets) must be
 /// called and must return CE_NONE before you can use any of the
 /// getters or setter.
+/// When the pdu has an option index it is filled in the same pass, the
+/// setters mark it stale.
 /// @param  [in] pdu pointer to the coap message struct.
 /// @return error code (CE_NONE == 0 == no error).
 /// @see    coap_error
@@ -286,6 +321,7 @@ coap_option coap_get_option(coap_pdu *pdu, coap_option *last);
 /// @param  [in]  occ  occurrence of to get (0th, 1st, 2nd, etc)
 ///                    0 for the first option.
 /// @return coap_option
+/// Uses a binary search in the option index when the pdu has one.
 ///
 coap_option coap_get_option_by_num(coap_pdu *pdu, coap_option_number num, uint8_t occ);
 
@@ -395,6 +431,100 @@ coap_error coap_add_option(coap_pdu *pdu, int32_t opt_num, uint8_t* value, uint1
 ///
 coap_error coap_set_payload(coap_pdu *pdu, uint8_t *payload, size_t payload_len);
 
+//
+// Builder
+//
+
+///
+/// Options a builder can stage
+///
+#ifndef COAP_BUILDER_MAX_OPTIONS
+#define COAP_BUILDER_MAX_OPTIONS 8
+#endif
+
+///
+/// Message Builder
+///
+/// Stages the options of a new message in any order, sorted by number on insert,
+/// and writes the message in one pass with coap_builder_finish: every option
+/// header and the payload marker are written exactly once, nothing is moved.
+/// The option values and the payload are not copied until then, they have to
+/// stay valid (integer options keep their value in the builder).
+///
+typedef struct coap_builder {
+	coap_pdu *pdu;
+	coap_error err;		/// first error, reported by coap_builder_finish
+	uint8_t count;
+	struct {
+		uint16_t num;
+		uint16_t len;
+		const uint8_t *val;
+		uint8_t uint_val[4];	/// value of an integer option
+	} opt[COAP_BUILDER_MAX_OPTIONS];
+	const uint8_t *payload;
+	size_t payload_len;
+} coap_builder;
+
+///
+/// Start Message
+///
+/// Starts a new message in the buffer of the pdu. The header and the token are written
+/// right away and pdu->len is set behind them, the options and the payload are only
+/// written by coap_builder_finish.
+/// @param  [out] b      the builder.
+/// @param  [in]  pdu    pointer to the coap message struct that receives the message.
+/// @param  [in]  mtype  message type.
+/// @param  [in]  code   message code.
+/// @param  [in]  mid    message ID.
+/// @param  [in]  token  token value.
+/// @param  [in]  tkl    token length.
+/// @return coap_error (0 == no error)
+///
+coap_error coap_builder_init(coap_builder *b, coap_pdu *pdu, coap_type mtype, coap_code code,
+                             uint16_t mid, uint64_t token, uint8_t tkl);
+
+///
+/// Add Option
+///
+/// Stages an option, in any order. Options with the same number keep the order they are added in.
+/// @param  [in, out] b    the builder.
+/// @param  [in]      num  option number.
+/// @param  [in]      val  option value, has to stay valid until coap_builder_finish.
+/// @param  [in]      len  length of the value.
+/// @return coap_error (0 == no error)
+///
+coap_error coap_builder_add_option(coap_builder *b, uint16_t num, const uint8_t *val, uint16_t len);
+
+///
+/// Add Integer Option
+///
+/// Stages an option with an unsigned integer value in its shortest encoding.
+/// @param  [in, out] b      the builder.
+/// @param  [in]      num    option number.
+/// @param  [in]      value  option value.
+/// @return coap_error (0 == no error)
+///
+coap_error coap_builder_add_uint_option(coap_builder *b, uint16_t num, uint32_t value);
+
+///
+/// Set Payload
+///
+/// @param  [in, out] b        the builder.
+/// @param  [in]      payload  the payload, has to stay valid until coap_builder_finish.
+/// @param  [in]      len      length of the payload.
+/// @return coap_error (0 == no error)
+///
+coap_error coap_builder_set_payload(coap_builder *b, const uint8_t *payload, size_t len);
+
+///
+/// Finish Message
+///
+/// Writes the header, the token, the options and the payload into the pdu.
+/// @param  [in, out] b  the builder.
+/// @return coap_error (0 == no error), the first error of the builder calls.
+///
+coap_error coap_builder_finish(coap_builder *b);
+
 ///
 /// Build Message Code from Class and Detail
 ///
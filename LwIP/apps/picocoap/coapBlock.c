@@ -0,0 +1,328 @@
+///
+/// @file	 coapBlock.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-08
+/// @brief	 Block-wise transfers (RFC 7959) for CoAP over LoRaWAN
+///
+/// @details One transfer at a time. Every block is a confirmable request of coapClient,
+///          the next block is sent from the completion callback of the previous one.
+///
+
+#include "coapBlock.h"
+#include "coapClient.h"
+#include "utilities.h"
+#include <string.h>
+
+struct coap_block_transfer {
+	uint8_t active;
+	coap_code method;			/// CC_PUT (Block1) or CC_GET (Block2)
+	const char *path;
+	uint32_t size;				/// size of the upload
+	uint32_t num;				/// number of the next block
+	uint8_t szx;				/// block size exponent
+	uint64_t token;
+	coap_block_source source;
+	coap_block_sink sink;
+	coap_block_done done;
+	void *arg;
+};
+
+static struct coap_block_transfer transfer;
+
+//Maximum payload of the current datarate, the slowest datarate until the MAC reports it
+static uint16_t link_max_payload = 51;
+
+static void block_response(void *arg, coap_transaction_status status, coap_pdu *response);
+
+
+//Value of a Block option of the response, 0 when it has none
+static uint8_t get_block(coap_pdu *pdu, coap_option_number num, uint32_t *value)
+{
+	coap_option option = coap_get_option_by_num(pdu, num, 0);
+	uint8_t i;
+
+	if(option.num == 0){
+		return 0;
+	}
+	*value = 0;
+	for(i = 0; i < option.len && i < 3; i++){
+		*value = (*value << 8) | option.val[i];
+	}
+	return 1;
+}
+
+static void block_finish(coap_code code)
+{
+	transfer.active = 0;
+	if(transfer.done != NULL){
+		transfer.done(transfer.arg, code);
+	}
+}
+
+//Builds the request of a block without the payload, the options are only written by coap_builder_finish.
+//An upload carries Size1 when size1 is set.
+static coap_error block_build(coap_pdu *pdu, uint32_t num, uint8_t more, uint8_t szx, uint8_t size1)
+{
+	coap_builder b;
+	const char *path = transfer.path;
+	size_t len;
+
+	//The type and message ID are set by coap_send_confirmable
+	coap_builder_init(&b, pdu, CT_CON, transfer.method, 0, transfer.token, 4);
+
+	while(*path != '\0'){
+		len = strcspn(path, "/");
+		coap_builder_add_option(&b, CON_URI_PATH, (const uint8_t*)path, len);
+		path += len;
+		if(*path == '/'){
+			path++;
+		}
+	}
+
+	if(transfer.method == CC_GET){
+		coap_builder_add_uint_option(&b, CON_BLOCK2, (num << 4) | szx);
+	}
+	else{
+		coap_builder_add_uint_option(&b, CON_BLOCK1, (num << 4) | (more << 3) | szx);
+		if(size1){
+			coap_builder_add_uint_option(&b, CON_SIZE1, transfer.size);
+		}
+	}
+	return coap_builder_finish(&b);
+}
+
+//Builds and sends the request of the next block
+static int block_send(void)
+{
+	uint8_t buf[COAP_CLIENT_MSG_LEN];
+	coap_pdu pdu = {buf, 0, sizeof(buf)};
+	uint32_t offset = 0;
+	size_t len = 0;
+	uint8_t more = 0;
+
+	//Block size of the transfer: what is left of the frame after the headers and the payload
+	//marker. The headers are measured with a Block option of the largest block number and,
+	//for an upload, the Size1 option of the first block.
+	//The blocks are not fragmented: the transfer fails when not even 16 bytes fit.
+	if(transfer.num == 0){
+		if(block_build(&pdu, 0xFFFFF, 1, COAP_BLOCK_MAX_SZX, 1) != CE_NONE ||
+		   coap_block_room(pdu.len + 1) < COAP_BLOCK_SIZE(0)){
+			return 1;
+		}
+		transfer.szx = coap_block_szx(pdu.len + 1);
+	}
+
+	if(transfer.method == CC_PUT){
+		offset = transfer.num << (transfer.szx + 4);
+		len = transfer.size - offset;
+		if(len > COAP_BLOCK_SIZE(transfer.szx)){
+			len = COAP_BLOCK_SIZE(transfer.szx);
+			more = 1;
+		}
+	}
+	if(block_build(&pdu, transfer.num, more, transfer.szx, transfer.num == 0) != CE_NONE){
+		return 1;
+	}
+
+	//The block is read from the source straight into the message
+	if(len != 0){
+		if(pdu.len + 1 + len > pdu.max){
+			return 1;
+		}
+		buf[pdu.len++] = 0xFF;
+		pdu.len += transfer.source(transfer.arg, offset, &buf[pdu.len], len);
+	}
+
+	return coap_send_confirmable(&pdu, block_response, NULL);
+}
+
+//Completion of the request of one block
+static void block_response(void *arg, coap_transaction_status status, coap_pdu *response)
+{
+	coap_payload payload;
+	coap_code code;
+	uint32_t value, offset;
+	uint8_t szx;
+
+	LWIP_UNUSED_ARG(arg);
+
+	if(status != CTS_ACKED){
+		block_finish(CC_EMPTY);
+		return;
+	}
+	code = coap_get_code(response);
+
+	//Block1: the server asks for the next block with 2.31 Continue
+	if(transfer.method == CC_PUT){
+		if(code != CC_CONTINUE){
+			block_finish(code);
+			return;
+		}
+		if(get_block(response, CON_BLOCK1, &value) && (value & 7) < transfer.szx){
+			//The server wants smaller blocks, continue at the same offset
+			transfer.num = ((transfer.num + 1) << transfer.szx) >> (value & 7);
+			transfer.szx = value & 7;
+		}
+		else{
+			transfer.num++;
+		}
+		if(block_send() != 0){
+			block_finish(CC_EMPTY);
+		}
+		return;
+	}
+
+	//Block2: hand the block to the sink
+	if(coap_get_code_class(response) != 2){
+		block_finish(code);
+		return;
+	}
+	payload = coap_get_payload(response);
+	if(!get_block(response, CON_BLOCK2, &value)){
+		//The whole representation fits in one response
+		if(payload.len != 0){
+			transfer.sink(transfer.arg, 0, payload.val, payload.len);
+		}
+		block_finish(code);
+		return;
+	}
+	szx = value & 7;
+	if(szx > COAP_BLOCK_MAX_SZX){
+		block_finish(CC_EMPTY);
+		return;
+	}
+	offset = (value >> 4) << (szx + 4);
+	if(payload.len != 0){
+		transfer.sink(transfer.arg, offset, payload.val, payload.len);
+	}
+	if(!(value & 0x08)){
+		block_finish(code);
+		return;
+	}
+
+	//Next block, with the smaller block size when the server chose one
+	if(szx < transfer.szx){
+		transfer.szx = szx;
+	}
+	transfer.num = (offset + payload.len) >> (transfer.szx + 4);
+	if(block_send() != 0){
+		block_finish(CC_EMPTY);
+	}
+}
+
+///
+/// Updates the maximum payload of the current datarate, called from the MAC event.
+/// @param  [in] maxPayload maximum FRMPayload length, 0 when unknown.
+///
+void coap_block_link_update(uint16_t maxPayload)
+{
+	if(maxPayload != 0){
+		link_max_payload = maxPayload;
+	}
+}
+
+///
+/// Room in One Frame
+///
+/// Payload bytes that fit behind the CoAP header in one frame at the current datarate.
+/// @param  [in] headerLen length of the CoAP message without the payload (payload marker included).
+/// @return the room in bytes, 0 when the header alone does not fit.
+///
+size_t coap_block_room(size_t headerLen)
+{
+	if(link_max_payload > headerLen + COAP_BLOCK_SCHC_OVERHEAD){
+		return link_max_payload - headerLen - COAP_BLOCK_SCHC_OVERHEAD;
+	}
+	return 0;
+}
+
+///
+/// Block Size
+///
+/// Largest block size that fits in one frame at the current datarate and in the
+/// message buffer of the client. Gives 0 (16 bytes) also when less fits, check that with
+/// coap_block_room.
+/// @param  [in] headerLen length of the CoAP message without the block (options and payload marker included).
+/// @return the block size exponent (SZX).
+///
+uint8_t coap_block_szx(size_t headerLen)
+{
+	size_t room = coap_block_room(headerLen);
+	uint8_t szx = COAP_BLOCK_MAX_SZX;
+
+	if(COAP_CLIENT_MSG_LEN < headerLen + room){
+		room = COAP_CLIENT_MSG_LEN > headerLen ? COAP_CLIENT_MSG_LEN - headerLen : 0;
+	}
+
+	while(szx > 0 && COAP_BLOCK_SIZE(szx) > room){
+		szx--;
+	}
+	return szx;
+}
+
+///
+/// Block-wise Upload
+///
+/// PUTs a representation with Block1, the blocks are read from the source.
+/// @param  [in] path Uri-Path segments separated by '/', has to stay valid.
+/// @param  [in] size size of the representation.
+/// @param  [in] source reads the blocks.
+/// @param  [in] done called at the end of the transfer, can be NULL.
+/// @param  [in] arg passed to the callbacks.
+/// @return 0 if the transfer is started, 1 if a transfer is already running, no transaction is free
+///         or a block of 16 bytes does not fit in one frame at the current datarate.
+///
+int coap_block_put(const char *path, uint32_t size, coap_block_source source, coap_block_done done, void *arg)
+{
+	if(transfer.active){
+		return 1;
+	}
+	transfer.method = CC_PUT;
+	transfer.path = path;
+	transfer.size = size;
+	transfer.num = 0;
+	transfer.token = (uint32_t)randr(0, 0x7FFFFFFE);
+	transfer.source = source;
+	transfer.sink = NULL;
+	transfer.done = done;
+	transfer.arg = arg;
+
+	if(block_send() != 0){
+		return 1;
+	}
+	transfer.active = 1;
+	return 0;
+}
+
+///
+/// Block-wise Download
+///
+/// GETs a representation with Block2, the blocks are handed to the sink.
+/// @param  [in] path Uri-Path segments separated by '/', has to stay valid.
+/// @param  [in] sink receives the blocks.
+/// @param  [in] done called at the end of the transfer, can be NULL.
+/// @param  [in] arg passed to the callbacks.
+/// @return 0 if the transfer is started, 1 if a transfer is already running, no transaction is free
+///         or a block of 16 bytes does not fit in one frame at the current datarate.
+///
+int coap_block_get(const char *path, coap_block_sink sink, coap_block_done done, void *arg)
+{
+	if(transfer.active){
+		return 1;
+	}
+	transfer.method = CC_GET;
+	transfer.path = path;
+	transfer.size = 0;
+	transfer.num = 0;
+	transfer.token = (uint32_t)randr(0, 0x7FFFFFFE);
+	transfer.source = NULL;
+	transfer.sink = sink;
+	transfer.done = done;
+	transfer.arg = arg;
+
+	if(block_send() != 0){
+		return 1;
+	}
+	transfer.active = 1;
+	return 0;
+}
@@ -0,0 +1,77 @@
+///
+/// @file	 coapBlock.h
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-08
+/// @brief	 Block-wise transfers (RFC 7959) for CoAP over LoRaWAN
+///
+/// @details Representations larger than one message are sent with Block1 (upload) and
+///          received with Block2 (download). The block size is chosen from the maximum
+///          payload of the current datarate minus the compressed headers, so that every
+///          block fits in one LoRaWAN frame without SCHC fragmentation. The blocks are
+///          read from a source callback and handed to a sink callback one at a time,
+///          the whole representation is never kept in RAM.
+///
+
+#ifndef _COAPBLOCK_H_
+#define _COAPBLOCK_H_
+
+#include "lwip/opt.h"
+#include "coap.h"
+
+///
+/// Bytes of the SCHC header in front of the compressed CoAP message (the RuleID).
+///
+#ifndef COAP_BLOCK_SCHC_OVERHEAD
+#define COAP_BLOCK_SCHC_OVERHEAD	1
+#endif
+
+///
+/// Largest block size exponent, SZX 6 = 1024 bytes
+///
+#define COAP_BLOCK_MAX_SZX			6
+
+///
+/// Block size of a block size exponent
+///
+#define COAP_BLOCK_SIZE(szx)		(16u << (szx))
+
+///
+/// Block Source
+///
+/// Copies a part of the representation that is uploaded.
+/// @param  [in] arg the argument of coap_block_put.
+/// @param  [in] offset offset in the representation.
+/// @param  [out] buf where the block is copied.
+/// @param  [in] len number of bytes to copy.
+/// @return the number of bytes copied.
+///
+typedef size_t (*coap_block_source)(void *arg, uint32_t offset, uint8_t *buf, size_t len);
+
+///
+/// Block Sink
+///
+/// Receives a part of the representation that is downloaded.
+/// @param  [in] arg the argument of coap_block_get.
+/// @param  [in] offset offset in the representation.
+/// @param  [in] buf the block, only valid during the call.
+/// @param  [in] len length of the block.
+///
+typedef void (*coap_block_sink)(void *arg, uint32_t offset, const uint8_t *buf, size_t len);
+
+///
+/// Transfer Done
+///
+/// Called once at the end of the transfer.
+/// @param  [in] arg the argument of coap_block_put or coap_block_get.
+/// @param  [in] code the response code of the last block, CC_EMPTY when the server
+///             did not answer or reset the transfer.
+///
+typedef void (*coap_block_done)(void *arg, coap_code code);
+
+void coap_block_link_update(uint16_t maxPayload);
+size_t coap_block_room(size_t headerLen);
+uint8_t coap_block_szx(size_t headerLen);
+int coap_block_put(const char *path, uint32_t size, coap_block_source source, coap_block_done done, void *arg);
+int coap_block_get(const char *path, coap_block_sink sink, coap_block_done done, void *arg);
+
+#endif /*_COAPBLOCK_H_*/
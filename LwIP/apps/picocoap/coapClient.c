@@ -4,20 +4,220 @@
 /// @date	 2017-05-18
 /// @brief	 CoAP Message Send and Receive
 ///
-/// @details
+/// @details Non-confirmable messages are sent without keeping state. Confirmable messages
+///          are kept in a transaction table of COAP_CLIENT_NSTART entries until the ACK (or
+///          the separate response) arrives, they are retransmitted with exponential backoff
+///          (RFC 7252, section 4.2). One TimerEvent_t is armed for the earliest deadline,
+///          the retransmissions themselves are done from coap_client_poll() in the main loop.
 ///
 
+#include <string.h>
 #include <lwip/netdb.h>
+#include "board.h"
 #include "coapClient.h"
+#include "coapRtt.h"
+#include "coapServer.h"
+#include "coapBlock.h"
 
 struct udp_pcb *udp_pcb;
 struct ip6_addr ip6_dest;
 
-#define MSG_BUF_LEN 64
-uint8_t msg_send_buf[MSG_BUF_LEN];
-coap_pdu msg_send = {msg_send_buf, 0, 64};
+#define MSG_BUF_LEN COAP_CLIENT_MSG_LEN
 uint8_t msg_recv_buf[MSG_BUF_LEN];
-coap_pdu msg_recv = {msg_recv_buf, 0, 64};
+coap_option_index msg_recv_idx;	//filled by coap_validate_pkt, the handlers look options up in it
+coap_pdu msg_recv = {msg_recv_buf, 0, MSG_BUF_LEN, &msg_recv_idx};
+
+typedef enum coap_transaction_state {
+	TS_FREE = 0,
+	TS_WAIT_ACK,		/// retransmitted until the ACK arrives
+	TS_WAIT_RESPONSE	/// empty ACK received, waiting for the separate response
+} coap_transaction_state;
+
+struct coap_transaction {
+	coap_transaction_state state;
+	uint16_t mid;
+	uint64_t token;
+	uint8_t retransmits;
+	uint32_t rto;				/// RTO the exchange started with, selects the backoff factor
+	uint32_t timeout;			/// current timeout in ms
+	TimerTime_t first_sent;		/// for the RTT measurement
+	TimerTime_t last_sent;
+	coap_transaction_cb callback;
+	void *arg;
+	uint8_t buf[MSG_BUF_LEN];	/// the message, for retransmissions
+	size_t len;
+};
+
+static struct coap_transaction transactions[COAP_CLIENT_NSTART];
+static TimerEvent_t transaction_timer;
+static volatile bool transaction_timeout = false;
+static uint16_t message_id_counter;
+
+//Probing rate of the non-confirmable messages: credit in bytes, scaled by 1000
+static uint32_t probe_credit;
+static TimerTime_t probe_updated;
+
+
+//Returns a new message ID
+static uint16_t coap_next_mid(void)
+{
+	return message_id_counter++;
+}
+
+//Sends a message buffer to the server
+static err_t coap_send_buf(uint8_t *buf, size_t len)
+{
+	struct pbuf *p;
+	err_t err;
+
+	p = pbuf_alloc(PBUF_TRANSPORT, (u16_t) len, PBUF_RAM);
+	if(p == NULL){
+		return ERR_MEM;
+	}
+	pbuf_take(p, buf, len);
+
+	//Pass the pbuf to the transport layer (udp_send)
+	err = udp_send(udp_pcb, p);
+
+	//Free pbuf, the interface keeps its own reference while the packet is queued.
+	pbuf_free(p);
+
+	return err;
+}
+
+//Takes len bytes from the probing credit, 0 when there is not enough credit yet
+static uint8_t probe_take(size_t len)
+{
+	TimerTime_t elapsed = TimerGetElapsedTime(probe_updated);
+	uint32_t max = COAP_CLIENT_PROBING_BURST * 1000UL;
+
+	//The credit grows by PROBING_RATE bytes per second, up to one burst
+	if(elapsed >= max / COAP_CLIENT_PROBING_RATE || probe_credit + elapsed * COAP_CLIENT_PROBING_RATE >= max){
+		probe_credit = max;
+	}
+	else{
+		probe_credit += elapsed * COAP_CLIENT_PROBING_RATE;
+	}
+	probe_updated = TimerGetCurrentTime();
+
+	if(probe_credit < len * 1000UL){
+		return 0;
+	}
+	probe_credit -= len * 1000UL;
+	return 1;
+}
+
+//Time in ms until the deadline of a transaction (0 when it is over)
+static uint32_t transaction_remaining(struct coap_transaction *t)
+{
+	TimerTime_t elapsed = TimerGetElapsedTime(t->last_sent);
+
+	return elapsed >= t->timeout ? 0 : t->timeout - elapsed;
+}
+
+//Arms the timer for the earliest deadline of the open transactions
+static void transaction_timer_arm(void)
+{
+	uint32_t remaining, earliest = 0;
+	bool active = false;
+	uint8_t i;
+
+	TimerStop(&transaction_timer);
+
+	for(i = 0; i < COAP_CLIENT_NSTART; i++){
+		if(transactions[i].state != TS_FREE){
+			remaining = transaction_remaining(&transactions[i]);
+			if(!active || remaining < earliest){
+				earliest = remaining;
+				active = true;
+			}
+		}
+	}
+
+	if(active){
+		TimerSetValue(&transaction_timer, earliest ? earliest : 1);
+		TimerStart(&transaction_timer);
+	}
+}
+
+//Closes the transaction and reports the result
+static void transaction_finish(struct coap_transaction *t, coap_transaction_status status, coap_pdu *response)
+{
+	coap_transaction_cb callback = t->callback;
+	void *arg = t->arg;
+
+	t->state = TS_FREE;
+	if(callback != NULL){
+		callback(arg, status, response);
+	}
+}
+
+//Function executed on the timeout of the earliest transaction (interrupt context)
+static void OnTransactionTimerEvent(void)
+{
+	TimerStop(&transaction_timer);
+	transaction_timeout = true;
+}
+
+//Sends an empty ACK for a confirmable (separate) response
+static void coap_send_empty_ack(uint16_t mid)
+{
+	uint8_t ack[4];
+
+	ack[0] = (COAP_V1 << 6) | (CT_ACK << 4);
+	ack[1] = CC_EMPTY;
+	ack[2] = mid >> 8;
+	ack[3] = mid;
+	coap_send_buf(ack, sizeof(ack));
+}
+
+//Matches a received message with the open transactions
+static void coap_client_handle(coap_pdu *pdu)
+{
+	struct coap_transaction *t;
+	coap_type type = coap_get_type(pdu);
+	uint16_t mid = coap_get_mid(pdu);
+	uint8_t i;
+
+	for(i = 0; i < COAP_CLIENT_NSTART; i++){
+		t = &transactions[i];
+		if(t->state == TS_FREE){
+			continue;
+		}
+
+		//ACK or RST of our confirmable message: matched on the message ID
+		if((type == CT_ACK || type == CT_RST) && t->state == TS_WAIT_ACK && t->mid == mid){
+
+			//Measured from the first transmission, the estimator weighs in the retransmissions
+			coap_rtt_sample(&udp_pcb->remote_ip, TimerGetElapsedTime(t->first_sent), t->retransmits);
+
+			if(type == CT_RST){
+				transaction_finish(t, CTS_RESET, pdu);
+			}
+			else if(coap_get_code(pdu) == CC_EMPTY){
+				//Separate response will follow, stop retransmitting
+				t->state = TS_WAIT_RESPONSE;
+				t->last_sent = TimerGetCurrentTime();
+				t->timeout = COAP_MAX_TRANSMIT_WAIT * 1000;
+			}
+			else{
+				transaction_finish(t, CTS_ACKED, pdu);
+			}
+			break;
+		}
+
+		//Separate response (CON or NON): matched on the token
+		if((type == CT_CON || type == CT_NON) && coap_get_code(pdu) != CC_EMPTY && t->token == coap_get_token(pdu)){
+			if(type == CT_CON){
+				coap_send_empty_ack(mid);
+			}
+			transaction_finish(t, CTS_ACKED, pdu);
+			break;
+		}
+	}
+
+	transaction_timer_arm();
+}
 
 //When it receives a CoAP response
 static void coap_input(void *arg, struct udp_pcb *upcb, struct pbuf *p,
@@ -28,53 +228,242 @@ static void coap_input(void *arg, struct udp_pcb *upcb, struct pbuf *p,
 
 		if (p != NULL) {
 		  //Extract CoAP message
+		  if (p->tot_len <= MSG_BUF_LEN) {
+			  msg_recv.len = pbuf_copy_partial(p, msg_recv.buf, p->tot_len, 0);
+			  if (coap_validate_pkt(&msg_recv) == CE_NONE) {
+				  //Requests (and pings) that the SCHC rule delivered on the client port go to the server
+				  if (coap_get_code_class(&msg_recv) == 0 &&
+						  (coap_get_code(&msg_recv) != CC_EMPTY || coap_get_type(&msg_recv) == CT_CON)) {
+					  coap_server_handle(upcb, &msg_recv, addr, port);
+				  } else if (!coap_server_reply(&msg_recv, addr, port)) {
+					  //Not a reply to an Observe notification
+					  coap_client_handle(&msg_recv);
+				  }
+			  }
+		  }
 		  pbuf_free(p);
 		}
 }
 
-//When it sends a CoAP request
-int coap_output(uint8_t* temp)
+//Builds the header of a non-confirmable PUT to write, the payload goes behind it
+static int output_header(coap_pdu *pdu, const char *path, uint16_t contentFormat)
 {
-	err_t err;
+	coap_builder b;
 
-	uint8_t* resource = (uint8_t*) "temp";
-	uint16_t message_id_counter = (uint16_t)rand();
+	coap_builder_init(&b, pdu, CT_NON, CC_PUT, coap_next_mid(), 0, 0);
+	coap_builder_add_option(&b, CON_URI_PATH, (const uint8_t*)path, strlen(path));
+	coap_builder_add_uint_option(&b, CON_CONTENT_FORMATt, contentFormat);
 
-	// Build Message
-	coap_init_pdu(&msg_send);
-	coap_set_version(&msg_send, COAP_V1);
-	coap_set_type(&msg_send, CT_NON);     //non-confirmable
-	coap_set_code(&msg_send, CC_PUT); // PUT to write
-	coap_set_mid(&msg_send, message_id_counter++);
-	coap_add_option(&msg_send, CON_URI_PATH, resource, 4);
+	if(coap_builder_finish(&b) != CE_NONE || pdu->len + 1 >= pdu->max){
+		return 1;
+	}
+	return 0;
+}
 
-	// coap_add_option(&msg_send, CON_URI_PATH, (uint8_t*)alias, strlen(alias));
-	// coap_add_option(&msg_send, CON_URI_QUERY, (uint8_t*)cik, strlen(cik));
+//Room for the payload behind the header and the payload marker, no more than fits in one frame
+static size_t output_room(const coap_pdu *pdu)
+{
+	size_t len = pdu->max - pdu->len - 1;
 
-	// to write (Put), set payload:
-	coap_set_payload(&msg_send, (uint8_t*)temp, 6);
-	//coap_set_payload(&msg_send, (uint8_t*)"282929", 6);
+	if(len > coap_block_room(pdu->len + 1)){
+		len = coap_block_room(pdu->len + 1);
+	}
+	return len;
+}
 
-	//Create pbuf for the udp/coap message
+///
+/// Send Message
+///
+/// Sends a non-confirmable PUT to the server. The message is built in the pbuf that is sent,
+/// the writer puts the payload straight behind the options. The writer gets no more room
+/// than is left in one frame at the current datarate (coap_block_room).
+/// The non-confirmable messages are held to COAP_CLIENT_PROBING_RATE.
+/// @param  [in] path Uri-Path of the resource, one segment.
+/// @param  [in] contentFormat Content-Format of the payload.
+/// @param  [in] writer writes the payload.
+/// @param  [in] arg passed to the writer.
+/// @return 0 if the message is queued, 1 otherwise (also when the probing rate is exceeded).
+///
+int coap_output(const char *path, uint16_t contentFormat, coap_payload_writer writer, void *arg)
+{
+	coap_pdu pdu;
 	struct pbuf *p;
-	p = pbuf_alloc(PBUF_TRANSPORT, (u16_t) msg_send.len, PBUF_RAM);
-	pbuf_take(p,msg_send.buf,msg_send.len);
+	size_t len;
+	err_t err;
+
+	//The message is built in the pbuf that is sent, UDP, IPv6 and SCHC put their headers in front of it
+	p = pbuf_alloc(PBUF_TRANSPORT, COAP_CLIENT_PBUF_LEN, PBUF_RAM);
+	if(p == NULL){
+		return 1;
+	}
+	pdu.buf = p->payload;
+	pdu.len = 0;
+	pdu.max = p->len;
+	pdu.idx = NULL;
+
+	if(output_header(&pdu, path, contentFormat) != 0){
+		pbuf_free(p);
+		return 1;
+	}
+
+	// to write (Put), the payload behind the payload marker, no more than fits in one frame:
+	len = output_room(&pdu);
+	len = writer(arg, &pdu.buf[pdu.len + 1], len);
+	if(len != 0){
+		pdu.buf[pdu.len] = 0xFF;
+		pdu.len += 1 + len;
+	}
+	pbuf_realloc(p, (u16_t)pdu.len);
+
+	//Non-confirmable messages get no answer to adapt to, they are held to PROBING_RATE
+	if(!probe_take(pdu.len)){
+		pbuf_free(p);
+		return 1;
+	}
 
 	//Pass the pbuf to the transport layer (udp_send)
 	err = udp_send(udp_pcb, p);
-	if(err != ERR_OK){
+
+	//Free pbuf on success and on error, the interface keeps its own reference while the packet is queued.
+	pbuf_free(p);
+
+	//ERR_WOULDBLOCK: the virtualloraif transmit queue is full
+	return err != ERR_OK;
+}
+
+///
+/// Output Room
+///
+/// Room the writer of coap_output gets at the current datarate, to decide whether it is
+/// worth sending yet. Only the header is built, in a scratch buffer on the stack, and no
+/// message ID is used up.
+/// @param  [in] path Uri-Path of the resource, one segment.
+/// @param  [in] contentFormat Content-Format of the payload.
+/// @return bytes of payload, 0 if the header does not fit in COAP_CLIENT_HEADER_LEN.
+///
+size_t coap_output_room(const char *path, uint16_t contentFormat)
+{
+	uint8_t buf[COAP_CLIENT_HEADER_LEN];
+	coap_pdu pdu = {buf, 0, sizeof(buf), NULL};
+	uint16_t mid = message_id_counter;
+	int err;
+
+	err = output_header(&pdu, path, contentFormat);
+	message_id_counter = mid;
+	if(err != 0){
+		return 0;
+	}
+	pdu.max = COAP_CLIENT_PBUF_LEN;
+	return output_room(&pdu);
+}
+
+///
+/// Send Confirmable Message
+///
+/// Sends the message as a confirmable message to the server and retransmits it until it is
+/// acknowledged. The type and the message ID of the pdu are set here. The token of the pdu
+/// is used to match a separate response.
+/// @param  [in] pdu the message to send.
+/// @param  [in] callback called with the result (ACK/response, RST or timeout), can be NULL.
+/// @param  [in] arg passed to the callback.
+/// @return 0 if the transaction is started, 1 if all COAP_CLIENT_NSTART transactions are
+///         in use or the message is too long.
+///
+int coap_send_confirmable(coap_pdu *pdu, coap_transaction_cb callback, void *arg)
+{
+	struct coap_transaction *t = NULL;
+	uint32_t rto;
+	uint8_t i;
+
+	if(pdu->len > MSG_BUF_LEN){
 		return 1;
 	}
 
-	//Free pbuf when packet send.
-	pbuf_free(p);
+	for(i = 0; i < COAP_CLIENT_NSTART; i++){
+		if(transactions[i].state == TS_FREE){
+			t = &transactions[i];
+			break;
+		}
+	}
+	if(t == NULL){
+		return 1;
+	}
+
+	coap_set_type(pdu, CT_CON);
+	coap_set_mid(pdu, coap_next_mid());
+
+	t->mid = coap_get_mid(pdu);
+	t->token = coap_get_token(pdu);
+	t->retransmits = 0;
+	t->callback = callback;
+	t->arg = arg;
+	memcpy(t->buf, pdu->buf, pdu->len);
+	t->len = pdu->len;
+
+	//Initial timeout between RTO and RTO * ACK_RANDOM_FACTOR (1.5)
+	rto = coap_rtt_rto(&udp_pcb->remote_ip);
+	t->rto = rto;
+	t->timeout = rto + (uint32_t)randr(0, rto / 2);
+
+	t->first_sent = TimerGetCurrentTime();
+	t->last_sent = t->first_sent;
+	t->state = TS_WAIT_ACK;
+
+	//A full transmit queue is handled like a lost message: the retransmission sends it again
+	coap_send_buf(t->buf, t->len);
+
+	transaction_timer_arm();
 
-    return 0;
+	return 0;
+}
+
+///
+/// Client Poll
+///
+/// Retransmits the confirmable messages whose timeout is over and reports the transactions
+/// that failed. Should be called from the main loop.
+///
+void coap_client_poll(void)
+{
+	struct coap_transaction *t;
+	uint8_t i;
+
+	if(!transaction_timeout){
+		return;
+	}
+	transaction_timeout = false;
+
+	for(i = 0; i < COAP_CLIENT_NSTART; i++){
+		t = &transactions[i];
+		if(t->state == TS_FREE || transaction_remaining(t) != 0){
+			continue;
+		}
+
+		if(t->state == TS_WAIT_ACK && t->retransmits < COAP_MAX_RETRANSMIT){
+			//Variable backoff factor
+			t->retransmits++;
+			t->timeout = coap_rtt_backoff(t->timeout, t->rto);
+			t->last_sent = TimerGetCurrentTime();
+			coap_send_buf(t->buf, t->len);
+		}
+		else{
+			transaction_finish(t, CTS_TIMEOUT, NULL);
+		}
+	}
+
+	transaction_timer_arm();
 }
 
 //Initialisation of the CoAP interface
 void udp_coap_pcpb_init(){
 
+	coap_rtt_init();
+
+	TimerInit(&transaction_timer, OnTransactionTimerEvent);
+	message_id_counter = (uint16_t)randr(0, 0xFFFF);
+	probe_credit = COAP_CLIENT_PROBING_BURST * 1000UL;
+	probe_updated = TimerGetCurrentTime();
+
 	//Application Server IPv6 Address: 2001:6a8:1d80:2021:230:48ff:fe5a:3ee4
 	//This is the IPv6 address of the server that will receive all the sensor (temperature) data.
 	IP6_ADDR_PART( &ip6_dest, 0, 0x20, 0x01, 0x06, 0xA8);
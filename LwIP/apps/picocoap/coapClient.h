@@ -16,7 +16,75 @@
 #include "lwip/stats.h"
 #include "lwip/udp.h"
 
+///
+/// Number of confirmable transactions that can be open at the same time (NSTART),
+/// every transaction keeps a copy of its message. More than 1 lets exchanges run in
+/// parallel, the adaptive RTO of coapRtt keeps them from congesting the gateway.
+///
+#ifndef COAP_CLIENT_NSTART
+#define COAP_CLIENT_NSTART COAP_NSTART
+#endif
+
+///
+/// Average rate of the non-confirmable messages in bytes per second (PROBING_RATE),
+/// with bursts of up to COAP_CLIENT_PROBING_BURST bytes.
+///
+#ifndef COAP_CLIENT_PROBING_RATE
+#define COAP_CLIENT_PROBING_RATE COAP_PROBING_RATE
+#endif
+
+#ifndef COAP_CLIENT_PROBING_BURST
+#define COAP_CLIENT_PROBING_BURST COAP_CLIENT_PBUF_LEN
+#endif
+
+///
+/// Largest message of the client, every open transaction keeps a copy of its message.
+/// Larger representations are sent with coapBlock.
+///
+#ifndef COAP_CLIENT_MSG_LEN
+#define COAP_CLIENT_MSG_LEN 64
+#endif
+
+///
+/// Room for a message that is built directly in a pbuf, the pbuf is trimmed to the
+/// message afterwards. The largest LoRaWAN payload by default.
+///
+#ifndef COAP_CLIENT_PBUF_LEN
+#define COAP_CLIENT_PBUF_LEN 242
+#endif
+
+///
+/// Scratch buffer coap_output_room builds the header of coap_output in, on the stack.
+///
+#ifndef COAP_CLIENT_HEADER_LEN
+#define COAP_CLIENT_HEADER_LEN 32
+#endif
+
+///
+/// Result of a confirmable transaction
+///
+typedef enum coap_transaction_status {
+	CTS_ACKED = 0,	/// ACK or (separate) response received
+	CTS_RESET,		/// the server answered with a RST
+	CTS_TIMEOUT		/// no answer after COAP_MAX_RETRANSMIT retransmissions
+} coap_transaction_status;
+
+///
+/// Completion callback of a confirmable transaction.
+/// The response is NULL on a timeout and only valid during the call.
+///
+typedef void (*coap_transaction_cb)(void *arg, coap_transaction_status status, coap_pdu *response);
+
+///
+/// Payload writer of coap_output.
+/// Writes the payload into buf and returns its length (0: no payload).
+///
+typedef size_t (*coap_payload_writer)(void *arg, uint8_t *buf, size_t max);
+
 void udp_coap_pcpb_init();
-int coap_output(uint8_t* temp);
+int coap_output(const char *path, uint16_t contentFormat, coap_payload_writer writer, void *arg);
+size_t coap_output_room(const char *path, uint16_t contentFormat);
+int coap_send_confirmable(coap_pdu *pdu, coap_transaction_cb callback, void *arg);
+void coap_client_poll(void);
 
 #endif /*_COAPCLIENT_H_*/
@@ -0,0 +1,233 @@
+///
+/// @file	 coapRtt.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-02
+/// @brief	 Round trip time estimator for CoAP over LoRaWAN
+///
+/// @details The STM32L151 has no FPU, the estimator only uses integer math:
+///          SRTT and RTTVAR are kept in ms, scaled by 8 and 4 like in TCP.
+///
+
+#include "coapRtt.h"
+#include "coap.h"
+
+struct coap_rtt_estimator {
+	uint32_t srtt;		/// smoothed RTT in ms, scaled by 8 (0: no sample yet)
+	uint32_t rttvar;	/// RTT variance in ms, scaled by 4
+};
+
+struct coap_rtt_peer {
+	ip_addr_t addr;
+	struct coap_rtt_estimator strong;	/// exchanges without retransmission
+	struct coap_rtt_estimator weak;		/// exchanges with one or two retransmissions
+	uint32_t rto;		/// overall RTO in ms (0: no sample yet)
+	uint8_t age;		/// 0 = most recently used
+};
+
+static struct coap_rtt_peer peers[COAP_RTT_PEERS];
+
+//Link figures of the last MAC events
+static uint32_t link_time_on_air;
+static int16_t link_rssi;
+static int8_t link_snr;
+static uint32_t link_time_off;
+
+
+//Returns the entry of the peer, or the entry that has not been used the longest when create is set.
+static struct coap_rtt_peer *peer_find(const ip_addr_t *peer, uint8_t create)
+{
+	struct coap_rtt_peer *found = NULL;
+	struct coap_rtt_peer *oldest = &peers[0];
+	uint8_t i;
+
+	for(i = 0; i < COAP_RTT_PEERS; i++){
+		if(ip_addr_cmp(&peers[i].addr, peer)){
+			found = &peers[i];
+		}
+		if(peers[i].age > oldest->age){
+			oldest = &peers[i];
+		}
+	}
+
+	if(found == NULL){
+		if(!create){
+			return NULL;
+		}
+		found = oldest;
+		ip_addr_copy(found->addr, *peer);
+		found->strong.srtt = 0;
+		found->weak.srtt = 0;
+		found->rto = 0;
+	}
+
+	//Mark as most recently used
+	for(i = 0; i < COAP_RTT_PEERS; i++){
+		if(peers[i].age < 255){
+			peers[i].age++;
+		}
+	}
+	found->age = 0;
+
+	return found;
+}
+
+///
+/// Initialisation of the estimator, forgets all peers.
+///
+void coap_rtt_init(void)
+{
+	uint8_t i;
+
+	for(i = 0; i < COAP_RTT_PEERS; i++){
+		ip_addr_set_zero(&peers[i].addr);
+		peers[i].strong.srtt = 0;
+		peers[i].weak.srtt = 0;
+		peers[i].rto = 0;
+		peers[i].age = 255;
+	}
+	link_time_on_air = 0;
+	link_rssi = 0;
+	link_snr = 0;
+	link_time_off = 0;
+}
+
+///
+/// Updates the link figures, called from the MAC event.
+/// @param  [in] timeOnAir time on air of the last uplink in ms, 0 when unknown.
+/// @param  [in] timeOff time the MAC keeps the device off after that uplink in ms
+///              (band and aggregated duty cycle), 0 when the duty cycle is not enforced.
+/// @param  [in] rssi RSSI of the last downlink, 0 when unknown.
+/// @param  [in] snr SNR of the last downlink in dB, 0 when unknown.
+///
+void coap_rtt_link_update(uint32_t timeOnAir, uint32_t timeOff, int16_t rssi, int8_t snr)
+{
+	if(timeOnAir != 0){
+		link_time_on_air = timeOnAir;
+		link_time_off = timeOff;
+	}
+	if(rssi != 0 || snr != 0){
+		link_rssi = rssi;
+		link_snr = snr;
+	}
+}
+
+///
+/// Minimum time one CoAP exchange needs on the LoRaWAN link in ms:
+/// the uplink, the wait for the second receive window and the answer (same datarate),
+/// and at least the off time the MAC reported after the uplink.
+/// @return the link bound in ms.
+///
+uint32_t coap_rtt_link_bound(void)
+{
+	uint32_t bound = 2 * link_time_on_air + COAP_RTT_RX_DELAY;
+
+	if(link_snr < COAP_RTT_LOW_SNR){
+		bound += link_time_on_air;
+	}
+	if(bound < link_time_off){
+		bound = link_time_off;
+	}
+	return bound;
+}
+
+//Adds a sample to one estimator, returns its RTO with the variance weighted by k
+static uint32_t estimator_sample(struct coap_rtt_estimator *e, uint32_t rtt, uint8_t k)
+{
+	uint32_t delta;
+
+	if(e->srtt == 0){
+		//First measurement: SRTT = R, RTTVAR = R/2
+		e->srtt = rtt << 3;
+		e->rttvar = rtt << 1;
+	}
+	else{
+		//RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|,  SRTT = 7/8 SRTT + 1/8 R
+		delta = (e->srtt >> 3) > rtt ? (e->srtt >> 3) - rtt : rtt - (e->srtt >> 3);
+		e->rttvar = e->rttvar - (e->rttvar >> 2) + delta;
+		e->srtt = e->srtt - (e->srtt >> 3) + rtt;
+	}
+
+	//RTO = SRTT + K RTTVAR
+	return (e->srtt >> 3) + (k * e->rttvar >> 2);
+}
+
+///
+/// Adds an RTT measurement of a peer, measured from the first transmission.
+/// Without retransmission it feeds the strong estimator, after one or two
+/// retransmissions the weak one. Later answers are too ambiguous and ignored.
+/// @param  [in] peer address of the peer.
+/// @param  [in] rtt measured round trip time in ms.
+/// @param  [in] retransmits number of retransmissions before the answer.
+///
+void coap_rtt_sample(const ip_addr_t *peer, uint32_t rtt, uint8_t retransmits)
+{
+	struct coap_rtt_peer *p;
+	uint32_t rto;
+
+	if(retransmits > 2){
+		return;
+	}
+	p = peer_find(peer, 1);
+	if(p->rto == 0){
+		p->rto = COAP_ACK_TIMEOUT * 1000;
+	}
+
+	if(retransmits == 0){
+		//RTO = 1/2 RTO_strong + 1/2 RTO, K = 4
+		rto = estimator_sample(&p->strong, rtt, 4);
+		p->rto = (rto >> 1) + (p->rto >> 1);
+	}
+	else{
+		//RTO = 1/4 RTO_weak + 3/4 RTO, K = 1
+		rto = estimator_sample(&p->weak, rtt, 1);
+		p->rto = (rto >> 2) + p->rto - (p->rto >> 2);
+	}
+}
+
+///
+/// Retransmission timeout for the first transmission of a confirmable message
+/// (the ACK_TIMEOUT of RFC 7252). The caller applies the random factor and the backoff.
+/// @param  [in] peer address of the peer.
+/// @return the timeout in ms.
+///
+uint32_t coap_rtt_rto(const ip_addr_t *peer)
+{
+	struct coap_rtt_peer *p = peer_find(peer, 0);
+	uint32_t rto = COAP_ACK_TIMEOUT * 1000;
+	uint32_t bound = coap_rtt_link_bound();
+
+	if(p != NULL && p->rto != 0){
+		rto = p->rto;
+	}
+
+	//The link bound wins over the upper bound: sooner the band is not free anyway
+	if(rto > COAP_RTT_MAX_RTO){
+		rto = COAP_RTT_MAX_RTO;
+	}
+	if(rto < bound){
+		rto = bound;
+	}
+	return rto;
+}
+
+///
+/// Variable backoff factor: the timeout of the next retransmission.
+/// @param  [in] timeout the timeout of the last transmission in ms.
+/// @param  [in] rto the RTO the exchange started with (coap_rtt_rto).
+/// @return the new timeout in ms.
+///
+uint32_t coap_rtt_backoff(uint32_t timeout, uint32_t rto)
+{
+	uint32_t bound = coap_rtt_link_bound();
+
+	if(rto < bound + COAP_RTT_VBF_LOW){
+		timeout *= 3;
+	}
+	else if(rto > bound + COAP_RTT_VBF_HIGH){
+		timeout += timeout >> 1;
+	}
+	else{
+		timeout <<= 1;
+	}
+	return timeout;
+}
@@ -0,0 +1,75 @@
+///
+/// @file	 coapRtt.h
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-02
+/// @brief	 Round trip time estimator for CoAP over LoRaWAN
+///
+/// @details Keeps a smoothed RTT and RTT variance per peer (RFC 6298, in ms with
+///          integer math) and bounds the retransmission timeout from below with the
+///          time the LoRaWAN link needs for one exchange: the time on air of the uplink,
+///          the delay of the receive windows and the time on air of the answer.
+///          The link figures are updated from the MAC events.
+///
+///          The estimator follows CoCoA (draft-ietf-core-cocoa): a strong estimate from
+///          exchanges without retransmission and a weak estimate from exchanges that
+///          needed one or two retransmissions (measured from the first transmission)
+///          are blended into one RTO per peer. The backoff factor depends on that RTO,
+///          so the retransmissions of many devices behind one gateway spread out instead
+///          of firing in step.
+///
+
+#ifndef _COAPRTT_H_
+#define _COAPRTT_H_
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+
+///
+/// Number of peers with their own estimate, the oldest peer is replaced.
+///
+#ifndef COAP_RTT_PEERS
+#define COAP_RTT_PEERS				2
+#endif
+
+///
+/// Delay of the second receive window after the end of the uplink in ms (RECEIVE_DELAY2).
+///
+#ifndef COAP_RTT_RX_DELAY
+#define COAP_RTT_RX_DELAY			2000
+#endif
+
+///
+/// Below this SNR (dB) of the last downlink the link is marginal and one
+/// extra time on air is added to the link bound for a likely MAC retry.
+///
+#ifndef COAP_RTT_LOW_SNR
+#define COAP_RTT_LOW_SNR			-10
+#endif
+
+///
+/// Upper bound of the estimated retransmission timeout in ms, the link bound can exceed it.
+///
+#ifndef COAP_RTT_MAX_RTO
+#define COAP_RTT_MAX_RTO			60000
+#endif
+
+///
+/// Variable backoff factor: x3 when the RTO is less than COAP_RTT_VBF_LOW ms above the
+/// link bound, x1.5 when it is more than COAP_RTT_VBF_HIGH ms above it, x2 otherwise.
+/// CoCoA uses 1 s and 3 s absolute, here they are relative to the LoRaWAN link bound.
+///
+#ifndef COAP_RTT_VBF_LOW
+#define COAP_RTT_VBF_LOW			1000
+#endif
+#ifndef COAP_RTT_VBF_HIGH
+#define COAP_RTT_VBF_HIGH			3000
+#endif
+
+void coap_rtt_init(void);
+void coap_rtt_link_update(uint32_t timeOnAir, uint32_t timeOff, int16_t rssi, int8_t snr);
+void coap_rtt_sample(const ip_addr_t *peer, uint32_t rtt, uint8_t retransmits);
+uint32_t coap_rtt_rto(const ip_addr_t *peer);
+uint32_t coap_rtt_backoff(uint32_t timeout, uint32_t rto);
+uint32_t coap_rtt_link_bound(void);
+
+#endif /*_COAPRTT_H_*/
@@ -0,0 +1,146 @@
+///
+/// @file	 coapSenml.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-12
+/// @brief	 SenML in CBOR (RFC 8428) for batches of sensor samples
+///
+/// @details Only the CBOR items SenML needs: unsigned and negative integers,
+///          text strings, arrays and maps (RFC 7049).
+///
+
+#include "coapSenml.h"
+#include <string.h>
+
+#define CBOR_UINT		0
+#define CBOR_NINT		1
+#define CBOR_TEXT		3
+#define CBOR_ARRAY		4
+#define CBOR_MAP		5
+
+struct cbor_writer {
+	uint8_t *buf;
+	size_t len;
+	size_t max;
+	uint8_t overflow;
+};
+
+
+//Head of a CBOR item: major type and argument in the shortest form
+static void cbor_head(struct cbor_writer *w, uint8_t major, uint32_t value)
+{
+	uint8_t n, i;
+
+	if(value < 24){
+		n = 0;
+	}
+	else if(value <= 0xFF){
+		n = 1;
+	}
+	else if(value <= 0xFFFF){
+		n = 2;
+	}
+	else{
+		n = 4;
+	}
+
+	if(w->len + 1 + n > w->max){
+		w->overflow = 1;
+		return;
+	}
+
+	if(n == 0){
+		w->buf[w->len++] = (major << 5) | value;
+		return;
+	}
+	w->buf[w->len++] = (major << 5) | (n == 1 ? 24 : n == 2 ? 25 : 26);
+	for(i = n; i > 0; i--){
+		w->buf[w->len++] = value >> (8 * (i - 1));
+	}
+}
+
+static void cbor_int(struct cbor_writer *w, int32_t value)
+{
+	if(value >= 0){
+		cbor_head(w, CBOR_UINT, value);
+	}
+	else{
+		cbor_head(w, CBOR_NINT, (uint32_t)(-1 - value));
+	}
+}
+
+static void cbor_text(struct cbor_writer *w, const char *text)
+{
+	size_t len = strlen(text);
+
+	cbor_head(w, CBOR_TEXT, len);
+	if(w->overflow || w->len + len > w->max){
+		w->overflow = 1;
+		return;
+	}
+	memcpy(&w->buf[w->len], text, len);
+	w->len += len;
+}
+
+///
+/// Encode Samples
+///
+/// Writes the samples as one SenML pack. The newest sample gives the base time, the first
+/// sample the base value, every record holds the value and time relative to them, which
+/// are small integers of one or two bytes.
+/// @param  [out] buf where the pack is written.
+/// @param  [in] max size of buf.
+/// @param  [in] name base name, e.g. the resource "temp".
+/// @param  [in] unit SenML unit, e.g. "Cel", NULL for none.
+/// @param  [in] samples the samples, oldest first.
+/// @param  [in] count number of samples.
+/// @return the length of the pack, 0 when it does not fit.
+///
+size_t senml_encode(uint8_t *buf, size_t max, const char *name, const char *unit,
+		const senml_sample *samples, uint8_t count)
+{
+	struct cbor_writer w = {buf, 0, max, 0};
+	uint32_t base_age;
+	int32_t base_value, t;
+	uint8_t i, fields;
+
+	if(count == 0){
+		return 0;
+	}
+	base_value = samples[0].value;
+	base_age = samples[count - 1].age;
+
+	cbor_head(&w, CBOR_ARRAY, count);
+	for(i = 0; i < count; i++){
+		t = -(int32_t)(samples[i].age - base_age);
+
+		//Value always, time only when it differs from the base time
+		fields = 1 + (t != 0);
+		if(i == 0){
+			fields += 1 + (unit != NULL) + (base_age != 0) + 1;
+		}
+		cbor_head(&w, CBOR_MAP, fields);
+
+		if(i == 0){
+			cbor_int(&w, SENML_BN);
+			cbor_text(&w, name);
+			if(base_age != 0){
+				cbor_int(&w, SENML_BT);
+				cbor_int(&w, -(int32_t)base_age);
+			}
+			if(unit != NULL){
+				cbor_int(&w, SENML_BU);
+				cbor_text(&w, unit);
+			}
+			cbor_int(&w, SENML_BV);
+			cbor_int(&w, base_value);
+		}
+		cbor_int(&w, SENML_V);
+		cbor_int(&w, samples[i].value - base_value);
+		if(t != 0){
+			cbor_int(&w, SENML_T);
+			cbor_int(&w, t);
+		}
+	}
+
+	return w.overflow ? 0 : w.len;
+}
@@ -0,0 +1,44 @@
+///
+/// @file	 coapSenml.h
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-12
+/// @brief	 SenML in CBOR (RFC 8428) for batches of sensor samples
+///
+/// @details The first record carries the base name, the unit, the base time and the base
+///          value, the other records only the difference with them. Times are relative to
+///          the moment of sending (negative seconds), the device has no clock. Values are
+///          integers, the STM32L151 has no FPU. Nothing is allocated, the records are
+///          written directly into the buffer of the outgoing message.
+///
+
+#ifndef _COAPSENML_H_
+#define _COAPSENML_H_
+
+#include "lwip/opt.h"
+#include <stddef.h>
+#include <stdint.h>
+
+///
+/// SenML Labels (RFC 8428, section 6)
+///
+#define SENML_BN					-2
+#define SENML_BT					-3
+#define SENML_BU					-4
+#define SENML_BV					-5
+#define SENML_N						0
+#define SENML_U						1
+#define SENML_V						2
+#define SENML_T						6
+
+///
+/// One sample
+///
+typedef struct senml_sample {
+	int32_t value;		/// in the unit of the pack
+	uint32_t age;		/// seconds before sending
+} senml_sample;
+
+size_t senml_encode(uint8_t *buf, size_t max, const char *name, const char *unit,
+		const senml_sample *samples, uint8_t count);
+
+#endif /*_COAPSENML_H_*/
@@ -0,0 +1,199 @@
+///
+/// @file	 coapSeries.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-14
+/// @brief	 Sample history and time-series compression for batched uplinks
+///
+/// @details The format is described in coapSeries.h.
+///
+
+#include "coapSeries.h"
+#include <string.h>
+
+struct bit_writer {
+	uint8_t *buf;		/// NULL: only count the bits
+	size_t pos;			/// in bits
+	size_t max;			/// in bits
+};
+
+
+static uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+//Appends the n lowest bits of value, 0 when they do not fit
+static uint8_t put_bits(struct bit_writer *w, uint32_t value, uint8_t n)
+{
+	uint8_t bit;
+
+	if(w->pos + n > w->max){
+		return 0;
+	}
+	if(w->buf == NULL){
+		w->pos += n;
+		return 1;
+	}
+	while(n--){
+		bit = (value >> n) & 1;
+		if(bit){
+			w->buf[w->pos >> 3] |= 0x80 >> (w->pos & 7);
+		}
+		else{
+			w->buf[w->pos >> 3] &= ~(0x80 >> (w->pos & 7));
+		}
+		w->pos++;
+	}
+	return 1;
+}
+
+static uint8_t put_dod(struct bit_writer *w, int32_t dod)
+{
+	uint32_t zz = zigzag(dod);
+
+	if(zz == 0){
+		return put_bits(w, 0, 1);
+	}
+	if(zz < (1UL << 7)){
+		return put_bits(w, 2, 2) && put_bits(w, zz, 7);
+	}
+	if(zz < (1UL << 9)){
+		return put_bits(w, 6, 3) && put_bits(w, zz, 9);
+	}
+	if(zz < (1UL << 12)){
+		return put_bits(w, 14, 4) && put_bits(w, zz, 12);
+	}
+	return put_bits(w, 15, 4) && put_bits(w, zz, 32);
+}
+
+static uint8_t put_delta(struct bit_writer *w, int32_t delta)
+{
+	uint32_t zz = zigzag(delta);
+
+	if(zz == 0){
+		return put_bits(w, 0, 1);
+	}
+	if(zz < (1UL << 4)){
+		return put_bits(w, 2, 2) && put_bits(w, zz, 4);
+	}
+	if(zz < (1UL << 8)){
+		return put_bits(w, 6, 3) && put_bits(w, zz, 8);
+	}
+	return put_bits(w, 7, 3) && put_bits(w, zz, 17);
+}
+
+void series_init(series_ring *ring)
+{
+	ring->head = 0;
+	ring->count = 0;
+}
+
+///
+/// Adds a sample, overwrites the oldest one when the history is full.
+/// @param  [in] ring the history.
+/// @param  [in] time time of the sample in ms.
+/// @param  [in] value the sample.
+///
+void series_add(series_ring *ring, uint32_t time, int16_t value)
+{
+	series_sample *s;
+
+	if(ring->count == COAP_SERIES_LEN){
+		ring->head = (ring->head + 1) % COAP_SERIES_LEN;
+		ring->count--;
+	}
+	s = &ring->samples[(ring->head + ring->count) % COAP_SERIES_LEN];
+	s->time = time;
+	s->value = value;
+	ring->count++;
+}
+
+uint8_t series_count(series_ring *ring)
+{
+	return ring->count;
+}
+
+///
+/// @param  [in] ring the history.
+/// @param  [in] i 0 for the oldest sample.
+/// @return the sample, NULL when there are not that many.
+///
+const series_sample *series_get(series_ring *ring, uint8_t i)
+{
+	if(i >= ring->count){
+		return NULL;
+	}
+	return &ring->samples[(ring->head + i) % COAP_SERIES_LEN];
+}
+
+///
+/// Removes the n oldest samples, after they are sent.
+///
+void series_drop(series_ring *ring, uint8_t n)
+{
+	if(n > ring->count){
+		n = ring->count;
+	}
+	ring->head = (ring->head + n) % COAP_SERIES_LEN;
+	ring->count -= n;
+}
+
+///
+/// Encode Samples
+///
+/// Packs the oldest samples into buf, as many as fit. The samples stay in the
+/// history, drop them with series_drop once the message is sent.
+/// @param  [in] ring the history.
+/// @param  [in] now the current time in ms, the ages are relative to it.
+/// @param  [out] buf where the samples are packed, NULL to only count the samples that fit.
+/// @param  [in] max size of buf.
+/// @param  [out] encoded number of samples packed.
+/// @return the length in bytes, 0 when not even one sample fits.
+///
+size_t series_encode(series_ring *ring, uint32_t now, uint8_t *buf, size_t max, uint8_t *encoded)
+{
+	struct bit_writer w = {buf, 0, max * 8};
+	const series_sample *first, *s;
+	uint32_t age, rel, last_rel = 0;
+	int32_t delta, last_delta = 0;
+	int16_t last_value;
+	size_t mark;
+	uint8_t n;
+
+	*encoded = 0;
+	first = series_get(ring, 0);
+	if(first == NULL || max < 6){
+		return 0;
+	}
+
+	age = (now - first->time) / 1000;
+	if(age > 0xFFFFFF){
+		age = 0xFFFFFF;
+	}
+	put_bits(&w, 1, 8);
+	put_bits(&w, age, 24);
+	put_bits(&w, (uint16_t)first->value, 16);
+	last_value = first->value;
+
+	for(n = 1; n < ring->count && n < 255; n++){
+		s = series_get(ring, n);
+		rel = (s->time - first->time) / 1000;
+		delta = (int32_t)(rel - last_rel);
+
+		mark = w.pos;
+		if(!put_dod(&w, delta - last_delta) || !put_delta(&w, (int32_t)s->value - last_value)){
+			//Does not fit anymore, the sample waits for the next frame
+			w.pos = mark;
+			break;
+		}
+		last_rel = rel;
+		last_delta = delta;
+		last_value = s->value;
+	}
+
+	if(buf != NULL){
+		buf[0] = n;
+	}
+	*encoded = n;
+	return (w.pos + 7) >> 3;
+}
@@ -0,0 +1,63 @@
+///
+/// @file	 coapSeries.h
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-14
+/// @brief	 Sample history and time-series compression for batched uplinks
+///
+/// @details The samples wait in a ring buffer until they are sent. The encoder packs as
+///          many of them as fit in the frame into a bit stream (MSB first), in the way of
+///          Gorilla: delta-of-delta timestamps and zig-zag value deltas with a variable
+///          length prefix. Regular samples of a slow sensor cost a few bits each.
+///          gateway/series/seriesDecode.c decodes the same format.
+///
+///          Header:  count (8 bits), age of the first sample in s (24 bits), first value (16 bits)
+///          Sample:  time   0                 delta-of-delta 0
+///                          10   + 7 bits     zig-zag delta-of-delta < 2^7
+///                          110  + 9 bits     < 2^9
+///                          1110 + 12 bits    < 2^12
+///                          1111 + 32 bits
+///                   value  0                 same value
+///                          10   + 4 bits     zig-zag delta < 2^4
+///                          110  + 8 bits     < 2^8
+///                          111  + 17 bits
+///          Times are in s relative to the first sample, the delta of the first sample is 0.
+///
+
+#ifndef _COAPSERIES_H_
+#define _COAPSERIES_H_
+
+#include "lwip/opt.h"
+#include <stddef.h>
+#include <stdint.h>
+
+///
+/// Samples kept in the history
+///
+#ifndef COAP_SERIES_LEN
+#define COAP_SERIES_LEN				32
+#endif
+
+typedef struct series_sample {
+	uint32_t time;		/// time of the sample in ms (TimerGetCurrentTime)
+	int16_t value;
+} series_sample;
+
+///
+/// Sample History
+///
+/// When it is full the oldest sample is overwritten.
+///
+typedef struct series_ring {
+	series_sample samples[COAP_SERIES_LEN];
+	uint8_t head;		/// oldest sample
+	uint8_t count;
+} series_ring;
+
+void series_init(series_ring *ring);
+void series_add(series_ring *ring, uint32_t time, int16_t value);
+uint8_t series_count(series_ring *ring);
+const series_sample *series_get(series_ring *ring, uint8_t i);
+void series_drop(series_ring *ring, uint8_t n);
+size_t series_encode(series_ring *ring, uint32_t now, uint8_t *buf, size_t max, uint8_t *encoded);
+
+#endif /*_COAPSERIES_H_*/
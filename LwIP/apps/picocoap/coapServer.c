@@ -0,0 +1,845 @@
+///
+/// @file	 coapServer.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-06
+/// @brief	 CoAP server of the device
+///
+/// @details
+///
+
+#include "board.h"
+#include "coapServer.h"
+#include <string.h>
+
+#define FNV_OFFSET		2166136261u
+#define FNV_PRIME		16777619u
+
+struct coap_observer {
+	coap_resource *resource;	/// NULL: free entry
+	struct udp_pcb *pcb;
+	ip_addr_t addr;
+	u16_t port;
+	uint64_t token;
+	uint8_t tkl;
+	uint32_t seq;				/// Observe sequence number (24 bits)
+	uint16_t mid;				/// message ID of the last notification
+	uint8_t non_count;			/// non-confirmable notifications since the last confirmable one
+	uint8_t unacked;			/// confirmable notifications without an ACK
+	uint8_t age;				/// 0 = most recently registered
+};
+
+//Response to a confirmable request, replayed when the request is retransmitted
+struct coap_dedup_entry {
+	uint8_t used;
+	ip_addr_t addr;
+	u16_t port;
+	uint16_t mid;
+	TimerTime_t stored;
+	uint8_t len;
+	uint8_t buf[COAP_SERVER_MSG_LEN];
+};
+
+//GET response of a cacheable resource
+struct coap_cache_entry {
+	coap_resource *resource;	/// NULL: free entry
+	uint8_t etag[COAP_ETAG_LEN];
+	uint8_t len;
+	uint8_t age;				/// 0 = most recently stored
+	uint8_t payload[COAP_CACHE_PAYLOAD_LEN];
+};
+
+//Response to a group request, sent when the leisure is over
+struct coap_group_response {
+	struct pbuf *p;				/// NULL: no response waiting
+	struct udp_pcb *pcb;
+	ip_addr_t addr;
+	u16_t port;
+};
+
+static struct udp_pcb *server_pcb;
+static coap_resource *resource_table;
+static uint8_t resource_count;
+static uint16_t server_mid;
+static struct coap_observer observers[COAP_OBSERVERS];
+static struct coap_dedup_entry dedup[COAP_DEDUP_ENTRIES];
+static struct coap_cache_entry cache[COAP_CACHE_ENTRIES];
+static struct coap_group_response group_response;
+static TimerEvent_t group_timer;
+static volatile bool group_due = false;
+
+static coap_code well_known_core(coap_pdu *request, coap_pdu *response);
+
+//GET /.well-known/core lists the resources (RFC 6690)
+static coap_resource well_known_resource = {
+	".well-known/core", COAP_METHOD_GET, COAP_CF_LINK_FORMAT, well_known_core, 0, 0
+};
+
+
+//FNV-1a of one path segment, preceded by the '/' separator
+static uint32_t hash_segment(uint32_t hash, const uint8_t *val, size_t len)
+{
+	hash = (hash ^ '/') * FNV_PRIME;
+	while(len--){
+		hash = (hash ^ *val++) * FNV_PRIME;
+	}
+	return hash;
+}
+
+//Hash of a path string of the resource table
+static uint32_t hash_path(const char *path)
+{
+	uint32_t hash = FNV_OFFSET;
+	const char *segment = path;
+
+	while(1){
+		if(*path == '/' || *path == '\0'){
+			hash = hash_segment(hash, (const uint8_t*)segment, path - segment);
+			if(*path == '\0'){
+				return hash;
+			}
+			segment = path + 1;
+		}
+		path++;
+	}
+}
+
+//Hash of the Uri-Path options of a request, read in place
+static uint32_t hash_request(coap_pdu *request)
+{
+	uint32_t hash = FNV_OFFSET;
+	coap_option option = coap_get_option(request, NULL);
+	uint8_t segments = 0;
+
+	while(option.num != 0){
+		if(option.num == CON_URI_PATH){
+			hash = hash_segment(hash, option.val, option.len);
+			segments++;
+		}
+		else if(option.num > CON_URI_PATH){
+			break;
+		}
+		option = coap_get_option(request, &option);
+	}
+
+	//No Uri-Path: the root resource ""
+	return segments ? hash : hash_segment(FNV_OFFSET, NULL, 0);
+}
+
+//Compares the Uri-Path options with a path string, guards against hash collisions
+static uint8_t path_equal(coap_pdu *request, const char *path)
+{
+	coap_option option = coap_get_option(request, NULL);
+	size_t len;
+
+	while(option.num != 0 && option.num <= CON_URI_PATH){
+		if(option.num == CON_URI_PATH){
+			len = strcspn(path, "/");
+			if(len != option.len || memcmp(path, option.val, len) != 0){
+				return 0;
+			}
+			path += len;
+			if(*path == '/'){
+				path++;
+			}
+		}
+		option = coap_get_option(request, &option);
+	}
+	return *path == '\0';
+}
+
+static coap_resource *resource_find(coap_pdu *request)
+{
+	uint32_t hash = hash_request(request);
+	uint8_t i;
+
+	if(hash == well_known_resource.hash && path_equal(request, well_known_resource.path)){
+		return &well_known_resource;
+	}
+	for(i = 0; i < resource_count; i++){
+		if(resource_table[i].hash == hash && path_equal(request, resource_table[i].path)){
+			return &resource_table[i];
+		}
+	}
+	return NULL;
+}
+
+static coap_code well_known_core(coap_pdu *request, coap_pdu *response)
+{
+	uint8_t links[COAP_SERVER_MSG_LEN];
+	size_t len = 0, n;
+	uint8_t i;
+
+	LWIP_UNUSED_ARG(request);
+
+	for(i = 0; i < resource_count; i++){
+		n = strlen(resource_table[i].path);
+		if(len + n + 4 > sizeof(links)){
+			break;
+		}
+		if(len){
+			links[len++] = ',';
+		}
+		links[len++] = '<';
+		links[len++] = '/';
+		memcpy(&links[len], resource_table[i].path, n);
+		len += n;
+		links[len++] = '>';
+	}
+
+	coap_set_payload(response, links, len);
+	return CC_CONTENT;
+}
+
+//Adds an option with an unsigned integer value in the shortest encoding
+static void add_uint_option(coap_pdu *pdu, coap_option_number num, uint32_t value)
+{
+	uint8_t buf[4];
+	uint8_t len = 0;
+
+	while(value >> (8 * len)){
+		len++;
+	}
+	for(uint8_t i = 0; i < len; i++){
+		buf[i] = value >> (8 * (len - 1 - i));
+	}
+	coap_add_option(pdu, num, buf, len);
+}
+
+//Value of the Observe option of a request, -1 when it has none
+static int32_t get_observe(coap_pdu *request)
+{
+	coap_option option = coap_get_option_by_num(request, CON_OBSERVE, 0);
+	int32_t value = 0;
+	uint8_t i;
+
+	if(option.num == 0){
+		return -1;
+	}
+	for(i = 0; i < option.len && i < 3; i++){
+		value = (value << 8) | option.val[i];
+	}
+	return value;
+}
+
+static struct coap_observer *observer_find(coap_resource *resource, const ip_addr_t *addr, u16_t port)
+{
+	uint8_t i;
+
+	for(i = 0; i < COAP_OBSERVERS; i++){
+		if(observers[i].resource == resource && observers[i].port == port && ip_addr_cmp(&observers[i].addr, addr)){
+			return &observers[i];
+		}
+	}
+	return NULL;
+}
+
+//Registers (or refreshes) an observer, replaces the oldest one when the table is full
+static struct coap_observer *observer_add(coap_resource *resource, struct udp_pcb *pcb,
+		const ip_addr_t *addr, u16_t port, coap_pdu *request)
+{
+	struct coap_observer *o = observer_find(resource, addr, port);
+	uint8_t i;
+
+	if(o == NULL){
+		o = &observers[0];
+		for(i = 0; i < COAP_OBSERVERS; i++){
+			if(observers[i].resource == NULL){
+				o = &observers[i];
+				break;
+			}
+			if(observers[i].age > o->age){
+				o = &observers[i];
+			}
+		}
+		o->resource = resource;
+		ip_addr_copy(o->addr, *addr);
+		o->port = port;
+		o->seq = 0;
+	}
+	o->pcb = pcb;
+	o->token = coap_get_token(request);
+	o->tkl = coap_get_tkl(request);
+	o->non_count = 0;
+	o->unacked = 0;
+
+	for(i = 0; i < COAP_OBSERVERS; i++){
+		if(observers[i].age < 255){
+			observers[i].age++;
+		}
+	}
+	o->age = 0;
+
+	return o;
+}
+
+//Sends a notification with the current value of the resource
+static void observer_notify(struct coap_observer *o)
+{
+	//The handler gets an empty GET, as if the observer asked for the resource again
+	uint8_t get[4] = {(COAP_V1 << 6) | (CT_NON << 4), CC_GET, 0, 0};
+	coap_pdu request = {get, sizeof(get), sizeof(get)};
+	coap_resource *resource = o->resource;
+	coap_pdu response;
+	coap_code code;
+	struct pbuf *p;
+
+	//Confirmable now and then, and until the last confirmable one is acknowledged
+	if(o->unacked >= COAP_OBSERVE_MAX_UNACKED){
+		//The observer is gone
+		o->resource = NULL;
+		return;
+	}
+
+	p = pbuf_alloc(PBUF_TRANSPORT, COAP_SERVER_MSG_LEN, PBUF_RAM);
+	if(p == NULL){
+		return;
+	}
+	response.buf = p->payload;
+	response.len = 0;
+	response.max = COAP_SERVER_MSG_LEN;
+	response.idx = NULL;
+
+	coap_init_pdu(&response);
+	coap_set_version(&response, COAP_V1);
+
+	if(o->unacked != 0 || o->non_count >= COAP_OBSERVE_CON_INTERVAL - 1){
+		coap_set_type(&response, CT_CON);
+		o->unacked++;
+		o->non_count = 0;
+	}
+	else{
+		coap_set_type(&response, CT_NON);
+		o->non_count++;
+	}
+	o->mid = server_mid++;
+	o->seq = (o->seq + 1) & 0xFFFFFF;
+	coap_set_mid(&response, o->mid);
+	coap_set_token(&response, o->token, o->tkl);
+	add_uint_option(&response, CON_OBSERVE, o->seq);
+	if(resource->content_format != COAP_CF_NONE){
+		add_uint_option(&response, CON_CONTENT_FORMATt, resource->content_format);
+	}
+	code = resource->handler(&request, &response);
+	if(resource->max_age != 0 && code == CC_CONTENT){
+		add_uint_option(&response, CON_MAX_AGE, resource->max_age);
+	}
+	coap_set_code(&response, code);
+
+	//An error response ends the observation (RFC 7641, section 3.2)
+	if(coap_get_code_class(&response) != 2){
+		o->resource = NULL;
+	}
+
+	pbuf_realloc(p, (u16_t)response.len);
+	udp_sendto(o->pcb, p, &o->addr, o->port);
+	pbuf_free(p);
+}
+
+//The response to an earlier copy of the request, NULL when it is new. Entries older than
+//EXCHANGE_LIFETIME are dropped here, on lookup, so no timer has to wake the MCU for them.
+static struct coap_dedup_entry *dedup_find(coap_pdu *request, const ip_addr_t *addr, u16_t port)
+{
+	uint16_t mid = coap_get_mid(request);
+	uint8_t i;
+
+	for(i = 0; i < COAP_DEDUP_ENTRIES; i++){
+		if(!dedup[i].used){
+			continue;
+		}
+		if(TimerGetElapsedTime(dedup[i].stored) >= COAP_EXCHANGE_LIFETIME * 1000UL){
+			dedup[i].used = 0;
+			continue;
+		}
+		if(dedup[i].mid == mid && dedup[i].port == port && ip_addr_cmp(&dedup[i].addr, addr)){
+			return &dedup[i];
+		}
+	}
+	return NULL;
+}
+
+//Keeps the response, replaces a free entry or else the oldest one
+static void dedup_store(coap_pdu *request, coap_pdu *response, const ip_addr_t *addr, u16_t port)
+{
+	struct coap_dedup_entry *e = &dedup[0];
+	uint8_t i;
+
+	for(i = 0; i < COAP_DEDUP_ENTRIES; i++){
+		if(!dedup[i].used){
+			e = &dedup[i];
+			break;
+		}
+		if(TimerGetElapsedTime(dedup[i].stored) > TimerGetElapsedTime(e->stored)){
+			e = &dedup[i];
+		}
+	}
+
+	e->used = 1;
+	ip_addr_copy(e->addr, *addr);
+	e->port = port;
+	e->mid = coap_get_mid(request);
+	e->stored = TimerGetCurrentTime();
+	e->len = response->len;
+	memcpy(e->buf, response->buf, response->len);
+}
+
+static struct coap_cache_entry *cache_find(coap_resource *resource)
+{
+	uint8_t i;
+
+	for(i = 0; i < COAP_CACHE_ENTRIES; i++){
+		if(cache[i].resource == resource){
+			return &cache[i];
+		}
+	}
+	return NULL;
+}
+
+//Keeps the payload of a response, replaces a free entry or else the oldest one
+static struct coap_cache_entry *cache_store(coap_resource *resource, const uint8_t *payload, size_t len)
+{
+	struct coap_cache_entry *e = &cache[0];
+	uint32_t hash = FNV_OFFSET;
+	uint8_t i;
+
+	for(i = 0; i < COAP_CACHE_ENTRIES; i++){
+		if(cache[i].resource == NULL){
+			e = &cache[i];
+			break;
+		}
+		if(cache[i].age > e->age){
+			e = &cache[i];
+		}
+	}
+	for(i = 0; i < COAP_CACHE_ENTRIES; i++){
+		if(cache[i].age < 255){
+			cache[i].age++;
+		}
+	}
+
+	//The ETag is a hash of the payload: an unchanged value keeps its ETag after an invalidation
+	for(i = 0; i < len; i++){
+		hash = (hash ^ payload[i]) * FNV_PRIME;
+	}
+	e->resource = resource;
+	e->etag[0] = hash >> 8;
+	e->etag[1] = hash;
+	e->len = len;
+	e->age = 0;
+	memcpy(e->payload, payload, len);
+	return e;
+}
+
+//1 when one of the ETag options of the request is the ETag of the entry
+static uint8_t cache_match(coap_pdu *request, struct coap_cache_entry *e)
+{
+	coap_option option;
+	uint8_t occ;
+
+	for(occ = 0; (option = coap_get_option_by_num(request, CON_ETAG, occ)).num != 0; occ++){
+		if(option.len == COAP_ETAG_LEN && memcmp(option.val, e->etag, COAP_ETAG_LEN) == 0){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//GET of a cacheable resource: the handler only runs when the response is not cached
+static coap_code cache_handle(coap_resource *resource, coap_pdu *request, coap_pdu *response)
+{
+	struct coap_cache_entry *e = cache_find(resource);
+	size_t start = response->len;
+	coap_payload payload;
+	coap_code code = CC_CONTENT;
+
+	if(resource->content_format != COAP_CF_NONE){
+		add_uint_option(response, CON_CONTENT_FORMATt, resource->content_format);
+	}
+
+	if(e == NULL){
+		code = resource->handler(request, response);
+		payload = coap_get_payload(response);
+		if(code != CC_CONTENT || payload.len > COAP_CACHE_PAYLOAD_LEN){
+			return code;
+		}
+		e = cache_store(resource, payload.val, payload.len);
+	}
+	else if(!cache_match(request, e)){
+		coap_set_payload(response, e->payload, e->len);
+	}
+
+	//The client has the current representation: 2.03 without Content-Format and payload
+	if(cache_match(request, e)){
+		response->len = start;
+		code = CC_VALID;
+	}
+	coap_add_option(response, CON_ETAG, e->etag, COAP_ETAG_LEN);
+	return code;
+}
+
+//Response classes the client is not interested in (No-Response option, RFC 7967),
+//bit 1 for 2.xx, bit 3 for 4.xx and bit 4 for 5.xx
+static uint8_t no_response(coap_pdu *request)
+{
+	coap_option option = coap_get_option_by_num(request, CON_NO_RESPONSE, 0);
+
+	return option.num != 0 && option.len != 0 ? option.val[option.len - 1] : 0;
+}
+
+static void OnGroupTimerEvent(void)
+{
+	TimerStop(&group_timer);
+	group_due = true;
+}
+
+//Keeps the response to a group request until the leisure is over. When a response
+//is still waiting the new one is dropped, the client asks again if it needs it.
+static void group_defer(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+	if(group_response.p != NULL){
+		pbuf_free(p);
+		return;
+	}
+	group_response.p = p;
+	group_response.pcb = pcb;
+	ip_addr_copy(group_response.addr, *addr);
+	group_response.port = port;
+
+	TimerSetValue(&group_timer, 1 + randr(0, COAP_GROUP_LEISURE));
+	TimerStart(&group_timer);
+}
+
+//When it receives a CoAP request on the server port
+static void coap_server_input(void *arg, struct udp_pcb *upcb, struct pbuf *p,
+                 const ip_addr_t *addr, u16_t port)
+{
+	uint8_t buf[COAP_SERVER_MSG_LEN];
+	coap_option_index idx;
+	coap_pdu request;
+
+	LWIP_UNUSED_ARG(arg);
+
+	if(p == NULL){
+		return;
+	}
+
+	//Parse the request in place, a chained pbuf is copied first
+	if(p->len == p->tot_len){
+		request.buf = p->payload;
+		request.len = p->len;
+	}
+	else if(p->tot_len <= sizeof(buf)){
+		request.buf = buf;
+		request.len = pbuf_copy_partial(p, buf, p->tot_len, 0);
+	}
+	else{
+		pbuf_free(p);
+		return;
+	}
+	request.max = request.len;
+	request.idx = &idx;
+
+	if(coap_validate_pkt(&request) == CE_NONE){
+		if(coap_get_type(&request) == CT_ACK || coap_get_type(&request) == CT_RST){
+			coap_server_reply(&request, addr, port);
+		}
+		else{
+			coap_server_handle(upcb, &request, addr, port);
+		}
+	}
+	pbuf_free(p);
+}
+
+///
+/// Server Initialisation
+///
+/// Registers the resource table, computes the hashes of the paths and listens on COAP_SERVER_PORT.
+/// Requests that arrive on the client port are passed on by coapClient.
+/// @param  [in] resources the resource table, has to stay valid.
+/// @param  [in] count number of resources.
+///
+void coap_server_init(coap_resource *resources, uint8_t count)
+{
+	uint8_t i;
+
+	resource_table = resources;
+	resource_count = count;
+	memset(observers, 0, sizeof(observers));
+	memset(dedup, 0, sizeof(dedup));
+	memset(cache, 0, sizeof(cache));
+	TimerInit(&group_timer, OnGroupTimerEvent);
+	for(i = 0; i < count; i++){
+		resources[i].hash = hash_path(resources[i].path);
+	}
+	well_known_resource.hash = hash_path(well_known_resource.path);
+
+	server_mid = (uint16_t)randr(0, 0xFFFF);
+
+	server_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+	if(server_pcb != NULL){
+		if(udp_bind(server_pcb, IP_ANY_TYPE, COAP_SERVER_PORT) == ERR_OK){
+			udp_recv(server_pcb, coap_server_input, NULL);
+		}
+		else{
+			udp_remove(server_pcb);
+			server_pcb = NULL;
+		}
+	}
+}
+
+///
+/// Handle Request
+///
+/// Dispatches a request to its resource and sends the response. A confirmable request gets
+/// a piggybacked response in the ACK. A group request (to a multicast address, RFC 7252,
+/// section 8) has to be non-confirmable, it gets no error response and the response waits
+/// a random leisure, coap_server_poll() sends it. Called from a UDP receive callback, the
+/// destination address of the request is the one of the packet that lwIP is handling.
+/// @param  [in] pcb the UDP pcb the request was received on.
+/// @param  [in] request the received (validated) request.
+/// @param  [in] addr address of the client.
+/// @param  [in] port port of the client.
+///
+void coap_server_handle(struct udp_pcb *pcb, coap_pdu *request, const ip_addr_t *addr, u16_t port)
+{
+	coap_type type = coap_get_type(request);
+	coap_code method = coap_get_code(request);
+	coap_resource *resource;
+	coap_pdu response;
+	coap_code code;
+	struct coap_observer *observer = NULL;
+	int32_t observe;
+	struct coap_dedup_entry *dedup_entry;
+	struct pbuf *p;
+	uint8_t group = ip_addr_ismulticast(ip_current_dest_addr());
+	uint8_t class;
+
+	if(type != CT_CON && type != CT_NON){
+		return;
+	}
+
+	//A confirmable group request would be acknowledged by every device of the group
+	if(group && type == CT_CON){
+		return;
+	}
+
+	//Retransmission of a request that was answered already: the same response again
+	if(type == CT_CON && method != CC_EMPTY && (dedup_entry = dedup_find(request, addr, port)) != NULL){
+		p = pbuf_alloc(PBUF_TRANSPORT, dedup_entry->len, PBUF_RAM);
+		if(p != NULL){
+			pbuf_take(p, dedup_entry->buf, dedup_entry->len);
+			udp_sendto(pcb, p, addr, port);
+			pbuf_free(p);
+		}
+		return;
+	}
+
+	//Build the response directly in the pbuf that is sent
+	p = pbuf_alloc(PBUF_TRANSPORT, COAP_SERVER_MSG_LEN, PBUF_RAM);
+	if(p == NULL){
+		return;
+	}
+	response.buf = p->payload;
+	response.len = 0;
+	response.max = COAP_SERVER_MSG_LEN;
+	response.idx = NULL;
+
+	coap_init_pdu(&response);
+	coap_set_version(&response, COAP_V1);
+
+	//CoAP ping: empty confirmable message, answer with a RST
+	if(method == CC_EMPTY){
+		if(type != CT_CON){
+			pbuf_free(p);
+			return;
+		}
+		coap_set_type(&response, CT_RST);
+		coap_set_code(&response, CC_EMPTY);
+		coap_set_mid(&response, coap_get_mid(request));
+	}
+	else{
+		if(type == CT_CON){
+			coap_set_type(&response, CT_ACK);
+			coap_set_mid(&response, coap_get_mid(request));
+		}
+		else{
+			coap_set_type(&response, CT_NON);
+			coap_set_mid(&response, server_mid++);
+		}
+		coap_set_token(&response, coap_get_token(request), coap_get_tkl(request));
+
+		resource = resource_find(request);
+		if(resource == NULL){
+			code = CC_NOT_FOUND;
+		}
+		else if(method > CC_DELETE || !(resource->methods & (1 << method))){
+			code = CC_METHOD_NOT_ALLOWED;
+		}
+		else{
+			//GET with Observe: register (0) or deregister (1) the client
+			if(method == CC_GET && (resource->methods & COAP_OBSERVABLE) && !group){
+				observe = get_observe(request);
+				if(observe == 0){
+					observer = observer_add(resource, pcb, addr, port, request);
+					add_uint_option(&response, CON_OBSERVE, observer->seq);
+				}
+				else if(observe == 1 && (observer = observer_find(resource, addr, port)) != NULL){
+					observer->resource = NULL;
+					observer = NULL;
+				}
+			}
+			if(method == CC_GET && (resource->methods & COAP_CACHEABLE)){
+				code = cache_handle(resource, request, &response);
+			}
+			else{
+				if(resource->content_format != COAP_CF_NONE){
+					add_uint_option(&response, CON_CONTENT_FORMATt, resource->content_format);
+				}
+				code = resource->handler(request, &response);
+			}
+			if(resource->max_age != 0 && (code == CC_CONTENT || code == CC_VALID)){
+				add_uint_option(&response, CON_MAX_AGE, resource->max_age);
+			}
+			//A successful update changes the representation
+			if(method != CC_GET && (code >> 5) == 2){
+				coap_server_invalidate(resource);
+			}
+		}
+		coap_set_code(&response, code);
+
+		//No observation on an error response
+		if(observer != NULL && coap_get_code_class(&response) != 2){
+			observer->resource = NULL;
+		}
+	}
+
+	if(type == CT_CON && method != CC_EMPTY){
+		dedup_store(request, &response, addr, port);
+	}
+
+	//Responses the client does not want, and no errors to a group request
+	if(type == CT_NON){
+		class = coap_get_code_class(&response);
+		if((no_response(request) & (1 << (class - 1))) || (group && class != 2)){
+			pbuf_free(p);
+			return;
+		}
+	}
+
+	pbuf_realloc(p, (u16_t)response.len);
+	if(group){
+		group_defer(pcb, p, addr, port);
+		return;
+	}
+	udp_sendto(pcb, p, addr, port);
+	pbuf_free(p);
+}
+
+///
+/// Handle Reply
+///
+/// Matches an ACK or RST with the last notification of the observers, on the message ID
+/// and the endpoint of the observer. A RST removes the observer (RFC 7641, section 3.6).
+/// @param  [in] reply the received ACK or RST.
+/// @param  [in] addr address the reply came from.
+/// @param  [in] port port the reply came from.
+/// @return 1 when the reply belongs to a notification.
+///
+uint8_t coap_server_reply(coap_pdu *reply, const ip_addr_t *addr, u16_t port)
+{
+	coap_type type = coap_get_type(reply);
+	uint16_t mid = coap_get_mid(reply);
+	uint8_t i;
+
+	for(i = 0; i < COAP_OBSERVERS; i++){
+		if(observers[i].resource == NULL || observers[i].mid != mid ||
+		   observers[i].port != port || !ip_addr_cmp(&observers[i].addr, addr)){
+			continue;
+		}
+		if(type == CT_RST){
+			observers[i].resource = NULL;
+			return 1;
+		}
+		if(type == CT_ACK && observers[i].unacked != 0){
+			observers[i].unacked = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+///
+/// Resource Observed
+///
+/// @param  [in] resource the resource.
+/// @return 1 when the resource has at least one observer.
+///
+uint8_t coap_server_observed(coap_resource *resource)
+{
+	uint8_t i;
+
+	for(i = 0; i < COAP_OBSERVERS; i++){
+		if(observers[i].resource == resource){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+///
+/// Notify Observers
+///
+/// Sends the current value of the resource to all its observers. Called by the
+/// application when the value has changed enough, not on a fixed timer.
+/// The cached response of the resource is invalidated.
+/// Confirmable notifications are not retransmitted: the next notification is sent
+/// confirmable again in its place, with the newer value (RFC 7641, section 4.5.2),
+/// until COAP_OBSERVE_MAX_UNACKED of them are not acknowledged.
+/// @param  [in] resource the resource that changed.
+///
+void coap_server_notify(coap_resource *resource)
+{
+	uint8_t i;
+
+	coap_server_invalidate(resource);
+	for(i = 0; i < COAP_OBSERVERS; i++){
+		if(observers[i].resource == resource){
+			observer_notify(&observers[i]);
+		}
+	}
+}
+
+///
+/// Invalidate Response
+///
+/// Drops the cached response of the resource, the next GET runs the handler again.
+/// Called by the application when the value of a cacheable resource changes, a
+/// successful PUT, POST or DELETE on the resource invalidates it as well.
+/// @param  [in] resource the resource that changed.
+///
+void coap_server_invalidate(coap_resource *resource)
+{
+	struct coap_cache_entry *e = cache_find(resource);
+
+	if(e != NULL){
+		e->resource = NULL;
+	}
+}
+
+///
+/// Server Poll
+///
+/// Sends the response to a group request when its leisure is over. Called from the main loop.
+///
+void coap_server_poll(void)
+{
+	if(!group_due){
+		return;
+	}
+	group_due = false;
+
+	if(group_response.p != NULL){
+		udp_sendto(group_response.pcb, group_response.p, &group_response.addr, group_response.port);
+		pbuf_free(group_response.p);
+		group_response.p = NULL;
+	}
+}
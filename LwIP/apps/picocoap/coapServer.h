@@ -0,0 +1,156 @@
+///
+/// @file	 coapServer.h
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-06
+/// @brief	 CoAP server of the device
+///
+/// @details Requests are dispatched with a static resource table. The Uri-Path of a request
+///          is hashed in place (the option bytes are not copied into a string) and compared
+///          with the hashes of the table, the response is built directly in the pbuf that is sent.
+///          Observable resources keep a small table of observers, the application calls
+///          coap_server_notify() when the value of the resource has changed enough.
+///          The GET responses of cacheable resources are kept with an ETag until the
+///          application invalidates them, a repeated GET does not run the handler again
+///          and a client that sends the current ETag gets 2.03 Valid without payload.
+///          Requests to a group (IPv6 multicast) address are answered after a random leisure,
+///          errors and the responses a client suppresses with No-Response are not sent.
+///
+
+#ifndef _COAPSERVER_H_
+#define _COAPSERVER_H_
+
+#include "lwip/opt.h"
+#include "lwip/udp.h"
+#include "coap.h"
+
+///
+/// UDP port of the CoAP server
+///
+#ifndef COAP_SERVER_PORT
+#define COAP_SERVER_PORT			5683
+#endif
+
+///
+/// Largest response, a response always fits in one LoRaWAN frame
+///
+#ifndef COAP_SERVER_MSG_LEN
+#define COAP_SERVER_MSG_LEN			64
+#endif
+
+///
+/// Responses to confirmable requests kept for duplicate detection. A retransmitted
+/// request (same peer and message ID) within COAP_EXCHANGE_LIFETIME gets the same
+/// response again, the handler is not run twice.
+///
+#ifndef COAP_DEDUP_ENTRIES
+#define COAP_DEDUP_ENTRIES			2
+#endif
+
+///
+/// Cached GET responses over all cacheable resources, a new one replaces the oldest.
+///
+#ifndef COAP_CACHE_ENTRIES
+#define COAP_CACHE_ENTRIES			2
+#endif
+
+///
+/// Largest cached payload, larger responses are not cached
+///
+#ifndef COAP_CACHE_PAYLOAD_LEN
+#define COAP_CACHE_PAYLOAD_LEN		16
+#endif
+
+///
+/// Length of the ETag, a hash of the payload
+///
+#define COAP_ETAG_LEN				2
+
+///
+/// Allowed methods of a resource (bit mask)
+///
+#define COAP_METHOD_GET				(1 << CC_GET)
+#define COAP_METHOD_POST			(1 << CC_POST)
+#define COAP_METHOD_PUT				(1 << CC_PUT)
+#define COAP_METHOD_DELETE			(1 << CC_DELETE)
+#define COAP_CACHEABLE				(1 << 6)	/// GET responses are cached until coap_server_invalidate()
+#define COAP_OBSERVABLE				(1 << 7)	/// GET with the Observe option registers an observer
+
+///
+/// Upper bound in ms of the random delay before the response to a group request
+/// (RFC 7252, section 8.2). All the devices of the group answer the same request, the
+/// leisure spreads their uplinks over the duty cycle of the LoRaWAN channels.
+///
+#ifndef COAP_GROUP_LEISURE
+#define COAP_GROUP_LEISURE			60000
+#endif
+
+///
+/// Number of observers (RFC 7641) over all resources, a new registration replaces the oldest.
+///
+#ifndef COAP_OBSERVERS
+#define COAP_OBSERVERS				2
+#endif
+
+///
+/// Every COAP_OBSERVE_CON_INTERVAL notifications one is sent confirmable to check
+/// that the observer is still interested (RFC 7641, section 4.5).
+///
+#ifndef COAP_OBSERVE_CON_INTERVAL
+#define COAP_OBSERVE_CON_INTERVAL	10
+#endif
+
+///
+/// An observer is removed after this many confirmable notifications without an ACK.
+/// A confirmable notification is not retransmitted, the notifications that follow
+/// take its place and stay confirmable until one is acknowledged.
+///
+#ifndef COAP_OBSERVE_MAX_UNACKED
+#define COAP_OBSERVE_MAX_UNACKED	3
+#endif
+
+///
+/// Content-Formats
+///
+#define COAP_CF_TEXT_PLAIN			0
+#define COAP_CF_LINK_FORMAT			40
+#define COAP_CF_OCTET_STREAM		42
+#define COAP_CF_JSON				50
+#define COAP_CF_CBOR				60
+#define COAP_CF_SENML_CBOR			112
+#define COAP_CF_NONE				0xFFFF	/// no Content-Format option in the response
+
+///
+/// Resource Handler
+///
+/// Handles a request of an allowed method. The response already holds the header, the token and
+/// the Content-Format of the resource, the handler adds the payload (and options with a higher number).
+/// The handler of a cacheable resource only adds the payload.
+/// @param  [in] request the received request.
+/// @param  [out] response the response that is built.
+/// @return the response code.
+///
+typedef coap_code (*coap_resource_handler)(coap_pdu *request, coap_pdu *response);
+
+///
+/// Resource
+///
+/// One entry of the resource table, the path has no leading '/' (e.g. "sensors/temp").
+///
+typedef struct coap_resource {
+	const char *path;				/// Uri-Path segments separated by '/'
+	uint8_t methods;				/// COAP_METHOD_x, COAP_CACHEABLE and COAP_OBSERVABLE
+	uint16_t content_format;		/// COAP_CF_x
+	coap_resource_handler handler;
+	uint32_t max_age;				/// Max-Age of the responses in s, 0: no option (60 s)
+	uint32_t hash;					/// hash of the path, set by coap_server_init
+} coap_resource;
+
+void coap_server_init(coap_resource *resources, uint8_t count);
+void coap_server_handle(struct udp_pcb *pcb, coap_pdu *request, const ip_addr_t *addr, u16_t port);
+uint8_t coap_server_reply(coap_pdu *reply, const ip_addr_t *addr, u16_t port);
+uint8_t coap_server_observed(coap_resource *resource);
+void coap_server_notify(coap_resource *resource);
+void coap_server_invalidate(coap_resource *resource);
+void coap_server_poll(void);
+
+#endif /*_COAPSERVER_H_*/
@@ -0,0 +1,134 @@
+///
+/// @file	 coapBlockTest.c
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-20
+/// @brief	 Host test of the block-wise uploads of coapBlock
+///
+/// @details Runs coap_block_put() over short and long paths, representation sizes that need
+///          Size1 options of 1 to 3 bytes, and the maximum payloads of the datarates. Every
+///          block request that coapBlock hands to coap_send_confirmable() has to fit in one
+///          frame together with the SCHC RuleID. The server is simulated: it answers every
+///          block with 2.31 Continue and the last one with 2.04 Changed.
+///          See readme.txt for the build line.
+///
+
+#include <stdio.h>
+#include <string.h>
+#include "../coapBlock.h"
+#include "../coapClient.h"
+
+static uint16_t frame_max;				//maximum payload of the datarate under test
+static coap_transaction_cb pending_cb;	//completion callback of the last block request
+static uint8_t sent_more;				//M bit of the last block request
+static uint32_t sent_count;
+static uint32_t errors;
+static coap_code result;
+
+//
+// utilities of the board and coapClient, replaced by the test
+//
+
+int32_t randr(int32_t min, int32_t max)
+{
+	return min;
+}
+
+int coap_send_confirmable(coap_pdu *pdu, coap_transaction_cb callback, void *arg)
+{
+	coap_option_index idx;
+	coap_pdu msg = {pdu->buf, pdu->len, pdu->len, &idx};
+	coap_option option;
+
+	if(pdu->len + COAP_BLOCK_SCHC_OVERHEAD > frame_max){
+		if(errors++ < 10){
+			printf("block %u: %u bytes, the frame holds %u\n",
+					sent_count, (unsigned)(pdu->len + COAP_BLOCK_SCHC_OVERHEAD), frame_max);
+		}
+	}
+	if(coap_validate_pkt(&msg) != CE_NONE){
+		errors++;
+		return 1;
+	}
+	option = coap_get_option_by_num(&msg, CON_BLOCK1, 0);
+	sent_more = option.num != 0 && option.len != 0 && (option.val[option.len - 1] & 0x08) != 0;
+	sent_count++;
+	pending_cb = callback;
+	return 0;
+}
+
+static size_t source(void *arg, uint32_t offset, uint8_t *buf, size_t len)
+{
+	memset(buf, 'x', len);
+	return len;
+}
+
+static void done(void *arg, coap_code code)
+{
+	result = code;
+}
+
+//Answers the last block request like a server that takes every block
+static void answer(void)
+{
+	uint8_t buf[8];
+	coap_pdu response = {buf, 0, sizeof(buf), NULL};
+	coap_builder b;
+	coap_transaction_cb cb = pending_cb;
+
+	pending_cb = NULL;
+	coap_builder_init(&b, &response, CT_ACK, sent_more ? CC_CONTINUE : CC_CHANGED, 0, 0, 0);
+	coap_builder_finish(&b);
+	cb(NULL, CTS_ACKED, &response);
+}
+
+static void upload(const char *path, uint32_t size, uint16_t maxPayload)
+{
+	uint32_t before = errors;
+
+	frame_max = maxPayload;
+	coap_block_link_update(maxPayload);
+	sent_count = 0;
+	result = CC_EMPTY;
+
+	if(coap_block_put(path, size, source, done, NULL) != 0){
+		//Only allowed when not even a block of 16 bytes fits. Upper bound of the header for the
+		//paths of this test (two segments at most): 8 bytes of header and token, 3 + len per
+		//segment, Block1 of 5 bytes, Size1 of 6 bytes and the payload marker.
+		if(coap_block_room(strlen(path) + 26) >= COAP_BLOCK_SIZE(0)){
+			printf("%s, %u bytes at %u: not started\n", path, size, maxPayload);
+			errors++;
+		}
+		return;
+	}
+	while(pending_cb != NULL && sent_count < 100000){
+		answer();
+	}
+	if(result != CC_CHANGED){
+		printf("%s, %u bytes at %u: ended with %u after %u blocks\n", path, size, maxPayload, result, sent_count);
+		errors++;
+	}
+	else if(errors != before){
+		printf("%s, %u bytes at %u: blocks too long\n", path, size, maxPayload);
+	}
+}
+
+int main(void)
+{
+	static const char *paths[] = {"fwv", "fw/v", "firmware", "abcdefghijkl", "abcdefghijklm/image"};
+	static const uint32_t sizes[] = {17, 100, 255, 256, 1000, 65535, 65536, 200000};
+	static const uint16_t payloads[] = {51, 115, 222, 242};
+	uint8_t p, s, m;
+	uint32_t runs = 0;
+
+	for(p = 0; p < sizeof(paths) / sizeof(paths[0]); p++){
+		for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+			for(m = 0; m < sizeof(payloads) / sizeof(payloads[0]); m++){
+				upload(paths[p], sizes[s], payloads[m]);
+				runs++;
+			}
+		}
+	}
+
+	printf("%u uploads, %u errors\n", runs, errors);
+	return errors != 0;
+}
@@ -0,0 +1,42 @@
+///
+/// @file	 hostcc.h
+/// @author	 Tomas Bolckmans
+/// @date	 2017-06-20
+/// @brief	 lwIP types for the host tests
+///
+/// @details The cc.h of the port types u32_t as unsigned long, 64 bits on a host. This file is
+///          included first (-include hostcc.h) and takes its place through the same guard.
+///
+
+#ifndef __CC_H__
+#define __CC_H__
+
+#include <stdint.h>
+
+typedef uint8_t		u8_t;
+typedef int8_t		s8_t;
+typedef uint16_t	u16_t;
+typedef int16_t		s16_t;
+typedef uint32_t	u32_t;
+typedef int32_t		s32_t;
+typedef uintptr_t	mem_ptr_t;
+typedef int			sys_prot_t;
+
+#define U16_F "hu"
+#define S16_F "d"
+#define X16_F "hx"
+#define U32_F "u"
+#define S32_F "d"
+#define X32_F "x"
+#define SZT_F "uz"
+
+#define PACK_STRUCT_BEGIN
+#define PACK_STRUCT_STRUCT __attribute__ ((__packed__))
+#define PACK_STRUCT_END
+#define PACK_STRUCT_FIELD(x) x
+
+#define LWIP_PLATFORM_ASSERT(x)
+
+#define BYTE_ORDER LITTLE_ENDIAN
+
+#endif /* __CC_H__ */
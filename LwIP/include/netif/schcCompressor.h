@@ -21,6 +21,17 @@
 
 #define AMOUNT_OF_FIELDS					    18
 
+//RuleID of a frame that carries several SCHC packets, each one prefixed with its length (1 byte)
+#define SCHC_PACKED_RULEID					0xFF
+
+//RuleID of a SCHC fragment, the fragment format is described in gateway/schc/schcReassembly.h
+#define SCHC_FRAG_RULEID					0xF0
+
+//Number of LoRaWAN multicast sessions that can be bound to an IPv6 multicast group
+#ifndef SCHC_GROUPS
+#define SCHC_GROUPS							2
+#endif
+
 struct ipv6_hdr {
    uint8_t version:4; 		//Version: 4 bits
    uint8_t tclass;			//Traffic Class: 8bits
@@ -68,13 +79,23 @@ struct SCHC_Rule{
 	struct SCHC_Field fields[AMOUNT_OF_FIELDS];
 };
 
+//Header fields of the last packet that was compressed or decompressed
+extern struct ipv6_hdr ipv6_header;
+extern struct udp_schc_hdr udp_header;
+
 err_t schc_if_init(struct netif *netif);
 err_t schc_input(struct pbuf * p, struct netif *netif);
+err_t schc_unpack(struct pbuf * p, struct netif *netif);
 err_t schc_output(struct netif *netif, struct pbuf *p, const ip6_addr_t *ip6addr);
 err_t schc_frag(struct pbuf * p, struct netif *netif);
 uint8_t schc_compression(uint8_t* schc_buffer);
 uint8_t schc_decompression(struct pbuf* p, uint8_t ruleId);
 
+//Multicast: the packets of a multicast session (DevAddr) go to the IPv6 group bound to it
+err_t schc_group_bind(struct netif *netif, uint32_t devAddr, const ip6_addr_t *group);
+err_t schc_group_unbind(struct netif *netif, uint32_t devAddr);
+void schc_rx_address(uint32_t devAddr);
+
 
 //Helper functions
 uint8_t equal(struct SCHC_Field* field, uint32_t headerField);
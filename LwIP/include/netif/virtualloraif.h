@@ -5,14 +5,69 @@
 #include "lwip/err.h"
 #include "lwip/netif.h"
 #include "netif/schcCompressor.h"
+#include "board.h"
+#include "LoRaMac.h"
 
+/*
+ * Traffic classes of the outgoing packets. The control class is always sent first,
+ * the other classes share the uplinks according to their weight.
+ * The class is taken from the DSCP of the IPv6 traffic class (set with udp_pcb->tos) or from the UDP port.
+ */
+#define VIRTUALLORAIF_CLASS_CONTROL			0	//ICMPv6 (ND), DSCP CS6/CS7/EF: CoAP ACKs and other control traffic
+#define VIRTUALLORAIF_CLASS_INTERACTIVE		1	//CoAP request/response traffic
+#define VIRTUALLORAIF_CLASS_BULK			2	//Telemetry and everything else, DSCP CS1
+#define VIRTUALLORAIF_CLASS_FRAGMENT		3	//SCHC fragment trains
+#define VIRTUALLORAIF_CLASSES				4
+
+/** Weights of the scheduler (uplinks per round) */
+#ifndef VIRTUALLORAIF_WEIGHT_INTERACTIVE
+#define VIRTUALLORAIF_WEIGHT_INTERACTIVE	4
+#endif
+#ifndef VIRTUALLORAIF_WEIGHT_BULK
+#define VIRTUALLORAIF_WEIGHT_BULK			2
+#endif
+#ifndef VIRTUALLORAIF_WEIGHT_FRAGMENT
+#define VIRTUALLORAIF_WEIGHT_FRAGMENT		1
+#endif
+
+/** Bit mask of the classes that are sent as confirmed frames (bit n = class n) */
+#ifndef VIRTUALLORAIF_CONFIRMED_CLASSES
+#define VIRTUALLORAIF_CONFIRMED_CLASSES		0
+#endif
+
+/** Number of transmissions of a confirmed frame */
+#ifndef VIRTUALLORAIF_CONFIRMED_TRIALS
+#define VIRTUALLORAIF_CONFIRMED_TRIALS		8
+#endif
+
+/** Number of packets the interface can hold while the MAC is busy (all classes together) */
+#ifndef VIRTUALLORAIF_TX_QUEUE_LEN
+#define VIRTUALLORAIF_TX_QUEUE_LEN		4
+#endif
+
+/** Time in ms a packet waits in the queue so the packets that follow can be sent in the same frame.
+ *  0 sends every packet as soon as it is queued. */
+#ifndef VIRTUALLORAIF_COALESCE_WINDOW
+#define VIRTUALLORAIF_COALESCE_WINDOW	250
+#endif
+
+/** LoRaWAN port used for the compressed IPv6 packets */
+#ifndef VIRTUALLORAIF_FPORT
+#define VIRTUALLORAIF_FPORT				10
+#endif
 
 extern uint8_t AppDataSize;
 extern uint8_t AppData[240];
 
 extern err_t virtualloraif_init(struct netif *netif);
 
-extern void virtualloraif_input(struct netif *netif);
+extern void virtualloraif_input(struct netif *netif, uint8_t *buf, u16_t len);
+
+extern void virtualloraif_poll(struct netif *netif);
+extern void virtualloraif_tx_done(struct netif *netif);
+extern void virtualloraif_frame_pending(struct netif *netif);
+extern err_t virtualloraif_set_device_class(struct netif *netif, DeviceClass_t deviceClass);
+extern u16_t virtualloraif_max_payload(struct netif *netif);
 //static void  virtualloraif_input(struct netif *netif);
 
 
@@ -8,6 +8,8 @@
  */
 
 #include "netif/schcCompressor.h"
+#include "lwip/mld6.h"
+#include "lwip/prot/icmp6.h"
 
 uint8_t DevEuiArray[] = LORAWAN_DEVICE_EUI;
 struct ipv6_hdr ipv6_header;	//This variable need to be global to support the contrained memory of the sensor
@@ -22,6 +24,15 @@ struct SCHC_Rule rule4;
 
 struct SCHC_Rule rules[4];
 
+//IPv6 multicast group bound to a LoRaWAN multicast session
+struct schc_group {
+	uint32_t devAddr;		//0: free entry
+	ip6_addr_t addr;
+};
+
+static struct schc_group groups[SCHC_GROUPS];
+static struct schc_group *rx_group;		//Group of the frame that is being received, NULL for unicast
+
 
 
 /**
@@ -44,13 +55,30 @@ err_t schc_input(struct pbuf * p, struct netif *netif)
 	ruleId = (uint8_t) pbuf_get_at(p, 0);
 
 	struct pbuf* q;
+	ip6_addr_t dst;
+
+	//Several packets in one frame, pass them one by one
+	if(ruleId == SCHC_PACKED_RULEID){
+		return schc_unpack(p, netif);
+	}
 
 	//Packet not compressed
 	if(ruleId == 0){
 		q = pbuf_alloc(PBUF_IP, p->tot_len-1, PBUF_POOL);
+		if(q == NULL){
+			pbuf_free(p);
+			return ERR_OK;
+		}
 
 		//place schc_header data in new pbuf
 		pbuf_take(q, p->payload+1, p->tot_len-1);
+
+		//A multicast session only carries packets for its group
+		if(rx_group != NULL && (pbuf_copy_partial(q, dst.addr, 16, 24) != 16 || !ip6_addr_cmp(&dst, &rx_group->addr))){
+			pbuf_free(q);
+			pbuf_free(p);
+			return ERR_OK;
+		}
 	}
 
 	//packet is compressed, apply decompression
@@ -59,6 +87,12 @@ err_t schc_input(struct pbuf * p, struct netif *netif)
 		//Apply decompression
 		uint8_t schc_offset = schc_decompression(p, ruleId);
 
+		//Frame of a multicast session: the rule holds the address of the device,
+		//the destination is the group bound to the session
+		if(rx_group != NULL){
+			memcpy(&ipv6_header.ip6_dst, rx_group->addr.addr, 16);
+		}
+
 		//Put the information of the globally used IPv6_header and UDP header struct in a byte array.
 		uint8_t buffer[48];
 
@@ -95,6 +129,10 @@ err_t schc_input(struct pbuf * p, struct netif *netif)
 
 		//Allocate a new packet
 		q = pbuf_alloc(PBUF_IP, IP6_HLEN + ipv6_header.paylength, PBUF_POOL);
+		if(q == NULL){
+			pbuf_free(p);
+			return ERR_OK;
+		}
 
 		//place schc_header data in new pbuf
 		pbuf_take(q, buffer, IP6_HLEN + UDP_HLEN);
@@ -104,14 +142,174 @@ err_t schc_input(struct pbuf * p, struct netif *netif)
 
 	}
 
+	//p can reference the receive buffer of the MAC (PBUF_REF), it is released here
+	//so nothing in lwIP holds on to it after the MAC event.
 	pbuf_free(p);
 
 	return ip6_input(q, netif);
 }
 
 
+/**
+ * Splits a frame with several SCHC packets (see SCHC_PACKED_RULEID) and passes every packet to schc_input.
+ * The packets reference the payload of the frame, they are not copied.
+ *
+ * @param p The received frame, contiguous in memory.
+ * @param netif The virtualloraif interface on which the frame was received.
+ *
+ * @return err_t
+ */
+err_t schc_unpack(struct pbuf * p, struct netif *netif)
+{
+	struct pbuf* q;
+	uint16_t offset = 1;
+	uint8_t len;
+
+	if(p->len != p->tot_len){
+		return ERR_BUF;
+	}
+
+	while(offset < p->tot_len){
+		len = pbuf_get_at(p, offset);
+		offset++;
+
+		if(len == 0 || offset + len > p->tot_len){
+			break;
+		}
+
+		q = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+		if(q == NULL){
+			break;
+		}
+		q->payload = (uint8_t*)p->payload + offset;
+		offset += len;
+
+		if(schc_input(q, netif) != ERR_OK){
+			pbuf_free(q);
+		}
+	}
+
+	pbuf_free(p);
+
+	return ERR_OK;
+}
+
+
+/**
+ * Binds a LoRaWAN multicast session to an IPv6 multicast group. The compressed packets of the
+ * session are decompressed with the group as destination, so one downlink reaches all the devices
+ * of the group. The network server manages the members of a multicast session: the MLD reports
+ * that lwIP sends for the group are dropped by schc_output().
+ *
+ * @param netif The virtualloraif interface that receives the frames.
+ * @param devAddr Address of the multicast session, as linked with LoRaMacMulticastChannelLink().
+ * @param group IPv6 multicast address.
+ *
+ * @return err_t
+ */
+err_t schc_group_bind(struct netif *netif, uint32_t devAddr, const ip6_addr_t *group)
+{
+	struct schc_group *g = NULL;
+	err_t err;
+	uint8_t i;
+
+	if(devAddr == 0 || !ip6_addr_ismulticast(group)){
+		return ERR_ARG;
+	}
+
+	for(i = 0; i < SCHC_GROUPS; i++){
+		if(groups[i].devAddr == devAddr){
+			g = &groups[i];
+			break;
+		}
+		if(g == NULL && groups[i].devAddr == 0){
+			g = &groups[i];
+		}
+	}
+	if(g == NULL){
+		return ERR_MEM;
+	}
+
+	err = mld6_joingroup_netif(netif, group);
+	if(err != ERR_OK){
+		return err;
+	}
+
+	//Bound again: leave the previous group
+	if(g->devAddr != 0){
+		mld6_leavegroup_netif(netif, &g->addr);
+	}
+	g->devAddr = devAddr;
+	ip6_addr_copy(g->addr, *group);
+
+	return ERR_OK;
+}
+
+/**
+ * Removes the binding of a multicast session and leaves its IPv6 group.
+ *
+ * @param netif The virtualloraif interface that receives the frames.
+ * @param devAddr Address of the multicast session.
+ *
+ * @return err_t
+ */
+err_t schc_group_unbind(struct netif *netif, uint32_t devAddr)
+{
+	uint8_t i;
+
+	for(i = 0; i < SCHC_GROUPS; i++){
+		if(devAddr != 0 && groups[i].devAddr == devAddr){
+			groups[i].devAddr = 0;
+			return mld6_leavegroup_netif(netif, &groups[i].addr);
+		}
+	}
+	return ERR_VAL;
+}
+
+/**
+ * Sets the address (DevAddr) of the frame that is passed to virtualloraif_input next.
+ * Called by the application for every received frame, before virtualloraif_input.
+ *
+ * @param devAddr Address of the frame, the address of the session for a multicast frame.
+ */
+void schc_rx_address(uint32_t devAddr)
+{
+	uint8_t i;
+
+	rx_group = NULL;
+	for(i = 0; i < SCHC_GROUPS; i++){
+		if(devAddr != 0 && groups[i].devAddr == devAddr){
+			rx_group = &groups[i];
+		}
+	}
+}
+
+
+/**
+ * Checks whether a packet is an MLD message (query, report or done). MLD messages carry a
+ * Hop-by-Hop header with the Router Alert option in front of the ICMPv6 header.
+ *
+ * @param p The IPv6 packet, the headers in the first pbuf.
+ *
+ * @return 1 for an MLD message
+ */
+static uint8_t schc_is_mld(struct pbuf *p){
+	uint8_t* buffer = p->payload;
+	uint16_t icmp;
+
+	if(buffer[6] != IP6_NEXTH_HOPBYHOP || p->len < IP6_HLEN + 2 || buffer[IP6_HLEN] != IP6_NEXTH_ICMP6){
+		return 0;
+	}
+	icmp = IP6_HLEN + (buffer[IP6_HLEN + 1] + 1) * 8;
+	if(p->len <= icmp){
+		return 0;
+	}
+	return buffer[icmp] == ICMP6_TYPE_MLQ || buffer[icmp] == ICMP6_TYPE_MLR || buffer[icmp] == ICMP6_TYPE_MLD;
+}
+
 /**
  * Will be called when an IPv6 has to be send. This method calls the method that will compress the IPv6 and UDP header.
+ * The SCHC header replaces the IPv6 and UDP header in place in the first pbuf of p.
  *
  * @param netif The virtualloraif interface which the IP packet will be sent on.
  * @param q The pbuf(s) containing the IP packet to be sent.
@@ -125,6 +323,16 @@ err_t schc_output(struct netif *netif, struct pbuf *p, const ip6_addr_t *ip6addr
 	uint8_t* buffer;
 	buffer = p->payload;
 
+	//Both headers are read from the first pbuf
+	if(p->len < IP6_HLEN + UDP_HLEN){
+		return ERR_BUF;
+	}
+
+	//The network server manages the multicast groups, MLD is not sent over LoRaWAN
+	if(schc_is_mld(p)){
+		return ERR_OK;
+	}
+
 	//Put the IPv6 header in the generaly used IPv6 and UDP header struct format.
     ipv6_header.version = ((buffer[0]) >> 4) & 15; 													// version: bit 0-3
     ipv6_header.tclass = ((buffer[0] << 4) & 240) | ((buffer[1] >> 4) & 15); 						// traffic class: bit 4-11
@@ -159,42 +367,47 @@ err_t schc_output(struct netif *netif, struct pbuf *p, const ip6_addr_t *ip6addr
     uint8_t schc_offset = schc_compression(schc_header);
 
     struct pbuf *p_compressed;
+    err_t err;
+
+    //The IPv6 and UDP headers were prepended in the first pbuf, the SCHC header
+    //replaces them in place. No new pbuf, the payload is not copied.
 
     //packet is not compressed, keep IPv6 header
     if(schc_header[0] == 0){
-    	p_compressed = pbuf_alloc(PBUF_RAW, schc_offset, PBUF_RAM);
-    	pbuf_take(p_compressed, schc_header, schc_offset);
-
-    	//Concatenate the ruleId with the original data (IPv6 header included)
-    	pbuf_cat(p_compressed, p);
-    	//pbuf_chain(p_compressed, p);
+    	if(pbuf_header(p, schc_offset) == 0){
+    		MEMCPY(p->payload, schc_header, schc_offset);
+    		p_compressed = p;
+    		pbuf_ref(p_compressed);
+    	}
+    	else{
+    		//No headroom left in front of the IPv6 header
+    		p_compressed = pbuf_alloc(PBUF_RAW, schc_offset, PBUF_RAM);
+    		if(p_compressed == NULL){
+    			return ERR_MEM;
+    		}
+    		pbuf_take(p_compressed, schc_header, schc_offset);
+
+    		//Chain the ruleId with the original data (IPv6 header included).
+    		//pbuf_chain takes its own reference, p still belongs to the caller.
+    		pbuf_chain(p_compressed, p);
+    	}
     }
 
-    //packet is compressed, strip IPv6 header
-    //UDP support will be added later
+    //packet is compressed, strip IPv6 and UDP header
     else{
-
-    	//UDP header will be stripped later
-    	//uint16_t data_length = p->tot_len - IP6_HLEN;
-    	uint16_t data_length = p->tot_len - IP6_HLEN - UDP_HLEN;
-
-    	uint16_t compressed_packet_length = data_length + schc_offset;
-
-    	p_compressed = pbuf_alloc(PBUF_RAW, compressed_packet_length, PBUF_RAM);
-
-    	//place schc_header data in new pbuf
-    	pbuf_take(p_compressed, schc_header, schc_offset);
-
-    	//place original data (without ipv6 header) in the pbuf
-    	pbuf_take_at(p_compressed, p->payload+IP6_HLEN+UDP_HLEN, data_length, schc_offset);
+    	pbuf_header(p, -(s16_t)(IP6_HLEN + UDP_HLEN - schc_offset));
+    	MEMCPY(p->payload, schc_header, schc_offset);
+    	p_compressed = p;
+    	pbuf_ref(p_compressed);
     }
 
 
-    pbuf_free(p);
-    mem_free(schc_header);
-
+	//p belongs to the caller (netif->output_ip6 does not take ownership), the reference
+	//taken above is released here, the link layer takes its own when it queues the packet.
+	err = schc_frag(p_compressed, netif);
+	pbuf_free(p_compressed);
 
-	return schc_frag(p_compressed, netif);
+	return err;
 }
 
 /**
@@ -32,7 +32,15 @@
 
 /* -------------------------------------------------------------------------------------------------------------
  * This virtual LoRa Interface is the connection between het IPv6 stack (LwIP) and the LoRaMAC code.
- * The AppData byte array is used to exchange data between the two layers (L3 <-> L2)
+ * Received frames are wrapped in a pbuf without copying them, the AppData byte array is only used
+ * as a contiguous staging buffer for chained outgoing packets.
+ *
+ * Outgoing packets are kept in a small queue of pbuf references until the MAC has sent them, so a packet
+ * that is emitted while the MAC is still busy does not overwrite the one in AppData.
+ * As soon as a packet is queued the interface posts an MCPS request to the MAC. When the MAC is busy the
+ * request is posted again from virtualloraif_poll() in the main loop, the duty cycle is enforced by the MAC
+ * itself (the frame is sent at the earliest permitted time).
+ * The end of the transmission (McpsConfirm) is reported with virtualloraif_tx_done().
  */
 
 #include "lwip/opt.h"
@@ -49,6 +57,51 @@
 
 #include "netif/virtualloraif.h"
 
+#define TX_SLOT_NONE		0xFF
+
+//Slot of the transmit queue, the classes share VIRTUALLORAIF_TX_QUEUE_LEN slots
+struct tx_slot {
+  struct pbuf *p;
+  u8_t next;				//Next slot of the same class or of the free list
+};
+
+//Transmit queue of a traffic class (list of slots, oldest first)
+struct tx_class_queue {
+  u8_t head;
+  u8_t tail;
+  u8_t count;
+  u8_t in_flight;			//Number of packets (from head) in the frame that is being sent by the MAC
+};
+
+static struct tx_slot tx_slots[VIRTUALLORAIF_TX_QUEUE_LEN];
+static u8_t tx_free;			//First free slot
+static struct tx_class_queue tx_queues[VIRTUALLORAIF_CLASSES];
+static u8_t tx_count;			//Queued packets of all classes
+static u8_t tx_in_flight;		//A frame is being sent by the MAC
+
+//Weighted round robin of the classes below the control class
+static const u8_t tx_weight[VIRTUALLORAIF_CLASSES] = {
+  0, VIRTUALLORAIF_WEIGHT_INTERACTIVE, VIRTUALLORAIF_WEIGHT_BULK, VIRTUALLORAIF_WEIGHT_FRAGMENT
+};
+static u8_t tx_credit[VIRTUALLORAIF_CLASSES];
+
+//Set from interrupt context (MAC event, timer), handled in virtualloraif_poll()
+static volatile u8_t tx_confirmed;	//The MAC has finished the frame in flight
+static volatile u8_t tx_ready;		//The coalescing window is over, the queued packets can be sent
+static volatile u8_t rx_pending;	//The network server has more downlinks (FPending)
+
+#if VIRTUALLORAIF_COALESCE_WINDOW > 0
+static TimerEvent_t tx_window_timer;
+
+/**
+ * Function executed when the coalescing window is over
+ */
+static void tx_window_event(void){
+  TimerStop(&tx_window_timer);
+  tx_ready = 1;
+}
+#endif
+
 
 /**
  * In this function, the hardware should be initialized.
@@ -93,87 +146,475 @@ static void low_level_init(struct netif *netif){
 
 	netif_ip6_addr_set(netif, 1, &ip6_global);
 	netif_ip6_addr_set_state(netif,1, IP6_ADDR_PREFERRED);
+
+	//All slots free, no class has packets
+	u8_t i;
+
+	for (i = 0; i < VIRTUALLORAIF_TX_QUEUE_LEN; i++) {
+		tx_slots[i].next = (i + 1 < VIRTUALLORAIF_TX_QUEUE_LEN) ? i + 1 : TX_SLOT_NONE;
+	}
+	tx_free = 0;
+	for (i = 0; i < VIRTUALLORAIF_CLASSES; i++) {
+		tx_queues[i].head = tx_queues[i].tail = TX_SLOT_NONE;
+	}
+
+#if VIRTUALLORAIF_COALESCE_WINDOW > 0
+	TimerInit(&tx_window_timer, tx_window_event);
+	TimerSetValue(&tx_window_timer, VIRTUALLORAIF_COALESCE_WINDOW);
+#endif
+}
+
+
+
+//Returns packet i (from head) of the transmit queue of a class
+static struct pbuf *tx_packet(struct tx_class_queue *q, u8_t i){
+  u8_t slot = q->head;
+
+  while (i--) {
+    slot = tx_slots[slot].next;
+  }
+  return tx_slots[slot].p;
+}
+
+//Releases the first n packets of the transmit queue of a class
+static void tx_release(struct tx_class_queue *q, u8_t n){
+  u8_t slot;
+
+  while (n--) {
+    slot = q->head;
+    pbuf_free(tx_slots[slot].p);
+    tx_slots[slot].p = NULL;
+    q->head = tx_slots[slot].next;
+    if (q->head == TX_SLOT_NONE) {
+      q->tail = TX_SLOT_NONE;
+    }
+    tx_slots[slot].next = tx_free;
+    tx_free = slot;
+    q->count--;
+    tx_count--;
+  }
+}
+
+/**
+ * Selects the traffic class of an outgoing packet. Uses the IPv6 and UDP header that
+ * schc_output() has just parsed into the global ipv6_header and udp_header.
+ *
+ * @param p the compressed (SCHC) packet
+ * @return VIRTUALLORAIF_CLASS_x
+ */
+static u8_t tx_classify(struct pbuf *p){
+  u8_t dscp = ipv6_header.tclass >> 2;
+
+  if (pbuf_get_at(p, 0) == SCHC_FRAG_RULEID) {
+    return VIRTUALLORAIF_CLASS_FRAGMENT;
+  }
+  if (ipv6_header.nheader == IP6_NEXTH_ICMP6 || dscp == 46 || dscp >= 48) {	//EF, CS6, CS7
+    return VIRTUALLORAIF_CLASS_CONTROL;
+  }
+  if (dscp == 8) {	//CS1: lower effort
+    return VIRTUALLORAIF_CLASS_BULK;
+  }
+  if (ipv6_header.nheader == IP6_NEXTH_UDP &&
+      (udp_header.srcPort == 5683 || udp_header.dstPort == 5683)) {
+    return VIRTUALLORAIF_CLASS_INTERACTIVE;
+  }
+  return VIRTUALLORAIF_CLASS_BULK;
 }
 
+/**
+ * Selects the class of the next frame: the control class has strict priority,
+ * the other classes are served by a weighted round robin.
+ *
+ * @return VIRTUALLORAIF_CLASS_x
+ */
+static u8_t tx_schedule(void){
+  u8_t c, round;
+
+  if (tx_queues[VIRTUALLORAIF_CLASS_CONTROL].count) {
+    return VIRTUALLORAIF_CLASS_CONTROL;
+  }
 
+  for (round = 0; round < 2; round++) {
+    for (c = VIRTUALLORAIF_CLASS_CONTROL + 1; c < VIRTUALLORAIF_CLASSES; c++) {
+      if (tx_queues[c].count && tx_credit[c]) {
+        tx_credit[c]--;
+        return c;
+      }
+    }
+    //Every class with packets used its credit, start a new round.
+    //A class with weight 0 still gets one uplink per round, else its packets would never leave.
+    for (c = 0; c < VIRTUALLORAIF_CLASSES; c++) {
+      tx_credit[c] = tx_weight[c] ? tx_weight[c] : 1;
+    }
+  }
+
+  //Not reached while tx_count counts the queued packets, never return an empty class
+  for (c = VIRTUALLORAIF_CLASS_CONTROL + 1; c < VIRTUALLORAIF_CLASSES - 1; c++) {
+    if (tx_queues[c].count) {
+      break;
+    }
+  }
+  return c;
+}
 
 /**
- * This function should do the actual transmission of the packet. The packet is
- * contained in the pbuf that is passed to the function. This pbuf
- * might be chained.
+ * Posts an MCPS request for the next queued packets when no frame is in flight.
+ * The scheduled class goes first. When more packets fit in the FRMPayload, the next packets of the same
+ * class and then of the other classes (in priority order, with the same confirmed setting) are packed
+ * behind it:
+ *
+ *   | SCHC_PACKED_RULEID | len 1 | SCHC packet 1 | len 2 | SCHC packet 2 | ...
+ *
+ * The MAC copies the payload in its own buffer, a packed frame or a chained pbuf is made
+ * contiguous in AppData first.
  *
  * @param netif the lwip network interface structure for this virtualloraif
- * @param p the MAC packet to send (e.g. IP packet including MAC addresses and type)
- * @return ERR_OK if the packet could be sent
- *         an err_t value if the packet couldn't be sent
+ */
+static void tx_start(struct netif *netif){
+  MibRequestConfirm_t mibGet;
+  McpsReq_t mcpsReq;
+  struct tx_class_queue *q;
+  struct pbuf *p;
+  u16_t maxPayload, len;
+  u8_t take[VIRTUALLORAIF_CLASSES];
+  u8_t order[VIRTUALLORAIF_CLASSES];	//The classes in the order they are packed
+  u8_t first, confirmed, c, i, k, n, classes;
+  void *buffer;
+
+  if (tx_in_flight || tx_count == 0) {
+    return;
+  }
+
+  maxPayload = virtualloraif_max_payload(netif);
+
+  first = tx_schedule();
+  confirmed = (VIRTUALLORAIF_CONFIRMED_CLASSES >> first) & 1;
+
+  //Count the packets that fit together in one frame
+  for (c = 0; c < VIRTUALLORAIF_CLASSES; c++) {
+    take[c] = 0;
+  }
+  n = 0;
+  classes = 0;
+  len = 1;
+  for (i = 0; i <= VIRTUALLORAIF_CLASSES; i++) {
+    //The scheduled class first, then the other classes in priority order
+    c = (i == 0) ? first : i - 1;
+    if ((i != 0 && c == first) || ((VIRTUALLORAIF_CONFIRMED_CLASSES >> c) & 1) != confirmed) {
+      continue;
+    }
+    order[classes++] = c;
+    q = &tx_queues[c];
+    while (take[c] < q->count) {
+      p = tx_packet(q, take[c]);
+      if (len + 1 + p->tot_len > maxPayload) {
+        break;
+      }
+      len += 1 + p->tot_len;
+      take[c]++;
+      n++;
+    }
+  }
+
+  if (n > 1 && take[first] != 0) {
+    //Packed in the order they were counted: the scheduled class leads the frame
+    AppData[0] = SCHC_PACKED_RULEID;
+    len = 1;
+    for (k = 0; k < classes; k++) {
+      c = order[k];
+      q = &tx_queues[c];
+      for (i = 0; i < take[c]; i++) {
+        p = tx_packet(q, i);
+        AppData[len++] = (u8_t)p->tot_len;
+        pbuf_copy_partial(p, &AppData[len], p->tot_len, 0);
+        len += p->tot_len;
+      }
+    }
+    AppDataSize = (u8_t)len;
+    buffer = AppData;
+  } else {
+    for (c = 0; c < VIRTUALLORAIF_CLASSES; c++) {
+      take[c] = 0;
+    }
+    take[first] = 1;
+
+    q = &tx_queues[first];
+    p = tx_packet(q, 0);
+    len = p->tot_len;
+
+    if (p->len == p->tot_len) {
+      buffer = p->payload;
+    } else if (p->tot_len <= sizeof(AppData)) {
+      //Copy the payload in de pbuf packet to the AppData byte-array
+      pbuf_copy_partial(p, AppData, p->tot_len, 0);
+      AppDataSize = p->tot_len;
+      buffer = AppData;
+    } else {
+      LINK_STATS_INC(link.lenerr);
+      MIB2_STATS_NETIF_INC(netif, ifouterrors);
+      tx_release(q, 1);
+      return;
+    }
+  }
+
+  mibGet.Type = MIB_CHANNELS_DATARATE;
+  LoRaMacMibGetRequestConfirm(&mibGet);
+
+  if (confirmed) {
+    mcpsReq.Type = MCPS_CONFIRMED;
+    mcpsReq.Req.Confirmed.fPort = VIRTUALLORAIF_FPORT;
+    mcpsReq.Req.Confirmed.fBuffer = buffer;
+    mcpsReq.Req.Confirmed.fBufferSize = len;
+    mcpsReq.Req.Confirmed.NbTrials = VIRTUALLORAIF_CONFIRMED_TRIALS;
+    mcpsReq.Req.Confirmed.Datarate = mibGet.Param.ChannelsDatarate;
+  } else {
+    mcpsReq.Type = MCPS_UNCONFIRMED;
+    mcpsReq.Req.Unconfirmed.fPort = VIRTUALLORAIF_FPORT;
+    mcpsReq.Req.Unconfirmed.fBuffer = buffer;
+    mcpsReq.Req.Unconfirmed.fBufferSize = len;
+    mcpsReq.Req.Unconfirmed.Datarate = mibGet.Param.ChannelsDatarate;
+  }
+
+  switch (LoRaMacMcpsRequest(&mcpsReq)) {
+    case LORAMAC_STATUS_OK:
+      tx_in_flight = 1;
+      for (c = 0; c < VIRTUALLORAIF_CLASSES; c++) {
+        tx_queues[c].in_flight = take[c];
+      }
+      break;
+
+    //Try again from virtualloraif_poll()
+    case LORAMAC_STATUS_BUSY:
+    case LORAMAC_STATUS_NO_NETWORK_JOINED:
+      break;
+
+    //The packet can never be sent (e.g. too long for the current datarate), drop it
+    default:
+      LINK_STATS_INC(link.err);
+      MIB2_STATS_NETIF_INC(netif, ifouterrors);
+      tx_release(&tx_queues[first], 1);
+      break;
+  }
+}
+
+/**
+ * Posts an empty uplink, it only opens the receive windows for the next downlink.
  *
- * @note Returning ERR_MEM here if a DMA queue of your MAC is full can lead to
- *       strange results. You might consider waiting for space in the DMA queue
- *       to become available since the stack doesn't retry to send a packet
- *       dropped because of memory failure (except for the TCP timers).
+ * @return 1 if the MAC accepted the request
+ */
+static u8_t tx_empty_uplink(void){
+  McpsReq_t mcpsReq;
+  MibRequestConfirm_t mibGet;
+
+  mibGet.Type = MIB_CHANNELS_DATARATE;
+  LoRaMacMibGetRequestConfirm(&mibGet);
+
+  mcpsReq.Type = MCPS_UNCONFIRMED;
+  mcpsReq.Req.Unconfirmed.fPort = VIRTUALLORAIF_FPORT;
+  mcpsReq.Req.Unconfirmed.fBuffer = NULL;
+  mcpsReq.Req.Unconfirmed.fBufferSize = 0;
+  mcpsReq.Req.Unconfirmed.Datarate = mibGet.Param.ChannelsDatarate;
+
+  if (LoRaMacMcpsRequest(&mcpsReq) == LORAMAC_STATUS_OK) {
+    tx_in_flight = 1;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Queues the packet for the MAC. The packet is contained in the pbuf that is
+ * passed to the function. This pbuf might be chained.
+ *
+ * @param netif the lwip network interface structure for this virtualloraif
+ * @param p the compressed (SCHC) packet to send
+ * @return ERR_OK if the packet is queued
+ *         ERR_WOULDBLOCK if the transmit queue is full, the packet is not sent
  */
 
 static err_t low_level_output(struct netif *netif, struct pbuf *p){
+  struct tx_class_queue *q;
+  u8_t slot;
+
+  //Queue full: tell lwIP to back off instead of overwriting a packet that is not sent yet
+  if (tx_free == TX_SLOT_NONE) {
+    LINK_STATS_INC(link.drop);
+    MIB2_STATS_NETIF_INC(netif, ifoutdiscards);
+    return ERR_WOULDBLOCK;
+  }
+
+  q = &tx_queues[tx_classify(p)];
 
+  //Keep a reference, the caller frees its own reference when we return
+  pbuf_ref(p);
+  slot = tx_free;
+  tx_free = tx_slots[slot].next;
+  tx_slots[slot].p = p;
+  tx_slots[slot].next = TX_SLOT_NONE;
+  if (q->tail == TX_SLOT_NONE) {
+    q->head = slot;
+  } else {
+    tx_slots[q->tail].next = slot;
+  }
+  q->tail = slot;
+  q->count++;
+  tx_count++;
 
-#if ETH_PAD_SIZE
-  pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
+  MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
+  LINK_STATS_INC(link.xmit);
+
+  //Don't wait for the application timer. While a frame is in flight the packet waits for
+  //the confirmation, otherwise it waits the coalescing window so packets that follow can share the frame.
+  if (!tx_in_flight) {
+#if VIRTUALLORAIF_COALESCE_WINDOW > 0
+    TimerStart(&tx_window_timer);	//Does nothing when the window is already running
+#else
+    tx_start(netif);
+    tx_ready = !tx_in_flight;		//MAC busy, try again from virtualloraif_poll()
 #endif
+  }
 
-  //Copy the payload in de pbuf packet to the AppData byte-array
-  	pbuf_copy_partial(p, AppData, p->tot_len, 0);
+  return ERR_OK;
+}
 
-  	//set total length of the compressed IP packet
-  	AppDataSize = p->tot_len;
+/**
+ * Called when the MAC has finished the transmission of the frame in flight (McpsConfirm).
+ * Runs in interrupt context, the packets are released and the next frame is sent from virtualloraif_poll().
+ *
+ * @param netif the lwip network interface structure for this virtualloraif
+ */
+void virtualloraif_tx_done(struct netif *netif){
+  LWIP_UNUSED_ARG(netif);
 
-  	pbuf_free(p);
+  tx_confirmed = 1;
+}
 
-  /* increase ifoutdiscards or ifouterrors on error */
+/**
+ * Should be called from the main loop. Releases the packets of a confirmed frame and posts the transmit
+ * request of the next queued packets when the MAC was busy before or the coalescing window is over.
+ *
+ * @param netif the lwip network interface structure for this virtualloraif
+ */
+void virtualloraif_poll(struct netif *netif){
+
+  u8_t c;
+
+  if (tx_confirmed) {
+    tx_confirmed = 0;
+    if (tx_in_flight) {
+      for (c = 0; c < VIRTUALLORAIF_CLASSES; c++) {
+        tx_release(&tx_queues[c], tx_queues[c].in_flight);
+        tx_queues[c].in_flight = 0;
+      }
+      tx_in_flight = 0;
+    }
 
-#if ETH_PAD_SIZE
-  pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
-#endif
+    //The packets that were queued in the meantime already waited longer than the window
+    tx_ready = 1;
+  }
 
-  LINK_STATS_INC(link.xmit);
+  //The server has more downlinks queued: the next uplink opens the receive windows for them.
+  //Queued packets go out immediately (piggybacked), otherwise an empty uplink is sent.
+  if (rx_pending && !tx_in_flight) {
+    if (tx_count) {
+      tx_ready = 1;
+      rx_pending = 0;
+    } else if (tx_empty_uplink()) {
+      rx_pending = 0;
+    }
+  }
 
-  return ERR_OK;
+  if (tx_ready) {
+    tx_start(netif);
+    if (tx_in_flight || tx_count == 0) {
+      tx_ready = 0;
+    }
+  }
 }
 
 /**
- * Should allocate a pbuf and transfer the bytes of the incoming
- * packet from the interface into the pbuf.
+ * Switches the LoRaWAN device class at runtime (MIB_DEVICE_CLASS).
+ * In class C the radio listens on RX2 whenever it is not transmitting, so a downlink reaches
+ * virtualloraif_input() without waiting for the next uplink. Only use it on mains-powered nodes.
  *
  * @param netif the lwip network interface structure for this virtualloraif
- * @return a pbuf filled with the received packet (including MAC header)
- *         NULL on memory error
+ * @param deviceClass CLASS_A or CLASS_C
+ * @return ERR_OK if the class is changed
+ *         ERR_INPROGRESS if the MAC is transmitting, try again later
+ *         ERR_VAL if the MAC refused the class
  */
-static struct pbuf * low_level_input(struct netif *netif){
-  //struct virtualloraif *virtualloraif = netif->state;
-  struct pbuf *p;
-  //u16_t len;
-  uint8_t len;
+err_t virtualloraif_set_device_class(struct netif *netif, DeviceClass_t deviceClass){
+  MibRequestConfirm_t mibSet;
 
-  /* The size of the packet and put it into the "len" variable. */
-  len = AppDataSize;
+  LWIP_UNUSED_ARG(netif);
 
-#if ETH_PAD_SIZE
-  len += ETH_PAD_SIZE; /* allow room for Ethernet padding */
-#endif
+  mibSet.Type = MIB_DEVICE_CLASS;
+  mibSet.Param.Class = deviceClass;
 
-  /* We allocate a pbuf chain of pbufs from the pool. */
-  p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+  switch (LoRaMacMibSetRequestConfirm(&mibSet)) {
+    case LORAMAC_STATUS_OK:
+      return ERR_OK;
+    case LORAMAC_STATUS_BUSY:
+      return ERR_INPROGRESS;
+    default:
+      return ERR_VAL;
+  }
+}
 
-  if (p != NULL) {
+/**
+ * Room for the packet in the next frame: what is left next to the pending MAC commands
+ * at the current datarate. The datarate changes with ADR, so ask again before every transfer.
+ *
+ * @param netif the lwip network interface structure for this virtualloraif
+ * @return the maximum FRMPayload length, 0 when the MAC cannot send now
+ */
+u16_t virtualloraif_max_payload(struct netif *netif){
+  LoRaMacTxInfo_t txInfo;
+  u16_t maxPayload = 0;
 
-#if ETH_PAD_SIZE
-    pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
-#endif
+  LWIP_UNUSED_ARG(netif);
 
+  if (LoRaMacQueryTxPossible(0, &txInfo) == LORAMAC_STATUS_OK) {
+    maxPayload = txInfo.MaxPossiblePayload;
+  }
+  if (maxPayload > sizeof(AppData)) {
+    maxPayload = sizeof(AppData);
+  }
+  return maxPayload;
+}
 
-    p->len = AppDataSize;
-    pbuf_take(p, AppData, AppDataSize);  //Put received data from AppData array in pBuf packet
+/**
+ * Called when a downlink had the FPending bit set (McpsIndication.FramePending).
+ * Runs in interrupt context, the uplink that fetches the next downlink is sent from virtualloraif_poll().
+ * The MAC delays that uplink until the duty cycle allows it.
+ *
+ * @param netif the lwip network interface structure for this virtualloraif
+ */
+void virtualloraif_frame_pending(struct netif *netif){
+  LWIP_UNUSED_ARG(netif);
+
+  rx_pending = 1;
+}
+
+/**
+ * Wraps the received frame in a PBUF_REF pbuf, the payload is not copied.
+ * The buffer of the MAC is only valid during the MAC event, that is fine because
+ * schc_input() decompresses it into a new pbuf before it returns.
+ *
+ * @param netif the lwip network interface structure for this virtualloraif
+ * @param buf the decrypted FRMPayload of the MAC
+ * @param len length of the FRMPayload
+ * @return a pbuf referencing the received packet
+ *         NULL on memory error
+ */
+static struct pbuf * low_level_input(struct netif *netif, uint8_t *buf, u16_t len){
+  struct pbuf *p;
+
+  p = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+
+  if (p != NULL) {
+    p->payload = buf;
 
-    //acknowledge that packet has been read();
     MIB2_STATS_NETIF_ADD(netif, ifinoctets, p->tot_len);
     if (((u8_t*)p->payload)[0] & 1) {
       /* broadcast or multicast packet*/
@@ -182,9 +623,6 @@ static struct pbuf * low_level_input(struct netif *netif){
       /* unicast packet*/
       MIB2_STATS_NETIF_INC(netif, ifinucastpkts);
     }
-#if ETH_PAD_SIZE
-    pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
-#endif
 
     LINK_STATS_INC(link.recv);
   } else {
@@ -198,19 +636,24 @@ static struct pbuf * low_level_input(struct netif *netif){
 }
 
 /**
- * This function should be called when a packet is ready to be read
- * from the interface. It uses the function low_level_input() that
- * should handle the actual reception of bytes from the network
- * interface. Then the type of the received packet is determined and
- * the appropriate input function is called.
+ * This function should be called when a packet is received by the MAC
+ * (from the MAC event of the LoRaWAN application port). It uses the function
+ * low_level_input() to wrap the payload in a pbuf and passes it to the
+ * input function of the interface.
  *
  * @param netif the lwip network interface structure for this virtualloraif
+ * @param buf the decrypted FRMPayload, only has to stay valid during the call
+ * @param len length of the FRMPayload
  */
-void virtualloraif_input(struct netif *netif){
+void virtualloraif_input(struct netif *netif, uint8_t *buf, u16_t len){
   struct pbuf *p;
 
+  if (buf == NULL || len == 0) {
+    return;
+  }
+
   /* put received data in pbuf packet */
-  p = low_level_input(netif);
+  p = low_level_input(netif, buf, len);
 
   /* If packet is not null: */
   if (p != NULL) {
@@ -0,0 +1,616 @@
+/**
+ * Gateway-side HTTP-CoAP cross-proxy, see coapProxy.h.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "coapProxy.h"
+#include "coap.h"
+
+#define NO_CONTENT_FORMAT	0xFFFF
+#define TOKEN_LEN			4
+#define MSG_LEN				(COAP_PROXY_BODY_LEN + COAP_PROXY_PATH_LEN + 32)
+
+static const struct {
+	uint16_t contentFormat;
+	const char *contentType;
+} mediaTypes[] = {
+	{0,		"text/plain;charset=utf-8"},
+	{40,	"application/link-format"},
+	{42,	"application/octet-stream"},
+	{50,	"application/json"},
+	{60,	"application/cbor"},
+	{112,	"application/senml+cbor"},
+};
+
+
+//FNV-1a of the path, mixed with the DevEUI
+static uint32_t key_hash(uint64_t devEui, const char *path){
+	uint32_t h = 2166136261u ^ (uint32_t)devEui ^ (uint32_t)(devEui >> 32) * 0x9E3779B1u;
+
+	while(*path != '\0'){
+		h = (h ^ (uint8_t)*path++) * 16777619u;
+	}
+	return h;
+}
+
+static const char *content_type(uint16_t contentFormat){
+	size_t i;
+
+	for(i = 0; i < sizeof(mediaTypes) / sizeof(mediaTypes[0]); i++){
+		if(mediaTypes[i].contentFormat == contentFormat){
+			return mediaTypes[i].contentType;
+		}
+	}
+	return "application/octet-stream";
+}
+
+//Content-Format of a Content-Type, the parameters of text/plain are ignored. -1 when unknown.
+static int32_t content_format(const char *contentType){
+	size_t i;
+
+	if(contentType[0] == '\0' || strncmp(contentType, "text/plain", 10) == 0){
+		return 0;
+	}
+	for(i = 1; i < sizeof(mediaTypes) / sizeof(mediaTypes[0]); i++){
+		if(strcmp(mediaTypes[i].contentType, contentType) == 0){
+			return mediaTypes[i].contentFormat;
+		}
+	}
+	return -1;
+}
+
+//HTTP status of a CoAP response code (RFC 8075, section 7)
+static int http_status(uint8_t code){
+	switch(code){
+	case CC_CREATED:				return 201;
+	case CC_DELETED:
+	case CC_CHANGED:				return 204;
+	case CC_VALID:
+	case CC_CONTENT:				return 200;
+	case CC_BAD_OPTION:				return 400;
+	case CC_REQUEST_ENTITY_TOO_LARGE:	return 413;
+	case CC_NOT_IMPLEMENTED:		return 501;
+	case CC_GATEWAY_TIMEOUT:		return 504;
+	case CC_SERVICE_UNAVAILABLE:	return 503;
+	default:
+		if((code >> 5) == 4){
+			//4.dd maps to 4dd for the codes that HTTP has
+			return 400 + (code & 0x1F);
+		}
+		if((code >> 5) == 5){
+			return code == CC_INTERNAL_SERVER_ERROR ? 500 : 502;
+		}
+		return 502;
+	}
+}
+
+//Target /<DevEUI in hex>/<Uri-Path>
+static int parse_target(const char *target, uint64_t *devEui, char *path){
+	const char *p = target + 1;
+	size_t n = 0;
+	char c;
+
+	if(target[0] != '/'){
+		return -1;
+	}
+	*devEui = 0;
+	for(; (c = *p) != '/' && c != '\0'; p++, n++){
+		if(c >= '0' && c <= '9')		*devEui = *devEui << 4 | (uint64_t)(c - '0');
+		else if(c >= 'a' && c <= 'f')	*devEui = *devEui << 4 | (uint64_t)(c - 'a' + 10);
+		else if(c >= 'A' && c <= 'F')	*devEui = *devEui << 4 | (uint64_t)(c - 'A' + 10);
+		else return -1;
+	}
+	if(n != 16 || c != '/' || p[1] == '\0' || strlen(p + 1) >= COAP_PROXY_PATH_LEN){
+		return -1;
+	}
+	//The query and the fragment are not forwarded
+	n = strcspn(p + 1, "?#");
+	memcpy(path, p + 1, n);
+	path[n] = '\0';
+	return n != 0 ? 0 : -1;
+}
+
+//Value of an integer option, def when the message does not have it
+static uint32_t option_uint(coap_pdu *pdu, coap_option_number num, uint32_t def){
+	coap_option option = coap_get_option_by_num(pdu, num, 0);
+	uint32_t value = 0;
+	size_t i;
+
+	if(option.num == 0){
+		return def;
+	}
+	for(i = 0; i < option.len && i < 4; i++){
+		value = (value << 8) | option.val[i];
+	}
+	return value;
+}
+
+static void reply_status(struct coap_proxy *px, void *client, int status){
+	struct http_response rsp;
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.status = status;
+	px->reply(px->arg, client, &rsp);
+}
+
+
+/*
+ * Cache
+ */
+
+static void lru_unlink(struct coap_proxy *px, uint32_t idx){
+	struct coap_proxy_entry *e = &px->entries[idx];
+
+	if(e->lruPrev != COAP_PROXY_NIL) px->entries[e->lruPrev].lruNext = e->lruNext;
+	else px->lruHead = e->lruNext;
+	if(e->lruNext != COAP_PROXY_NIL) px->entries[e->lruNext].lruPrev = e->lruPrev;
+	else px->lruTail = e->lruPrev;
+}
+
+//Marks the entry as most recently used
+static void lru_touch(struct coap_proxy *px, uint32_t idx){
+	struct coap_proxy_entry *e = &px->entries[idx];
+
+	lru_unlink(px, idx);
+	e->lruPrev = px->lruTail;
+	e->lruNext = COAP_PROXY_NIL;
+	if(px->lruTail != COAP_PROXY_NIL) px->entries[px->lruTail].lruNext = idx;
+	else px->lruHead = idx;
+	px->lruTail = idx;
+}
+
+static uint32_t cache_find(struct coap_proxy *px, uint64_t devEui, const char *path, uint32_t hash){
+	uint32_t idx;
+
+	for(idx = px->buckets[hash & px->bucketMask]; idx != COAP_PROXY_NIL; idx = px->entries[idx].next){
+		if(px->entries[idx].hash == hash && px->entries[idx].devEui == devEui && strcmp(px->entries[idx].path, path) == 0){
+			return idx;
+		}
+	}
+	return COAP_PROXY_NIL;
+}
+
+static void cache_remove(struct coap_proxy *px, uint32_t idx){
+	struct coap_proxy_entry *e = &px->entries[idx];
+	uint32_t *link = &px->buckets[e->hash & px->bucketMask];
+	uint32_t i;
+
+	while(*link != idx){
+		link = &px->entries[*link].next;
+	}
+	*link = e->next;
+	lru_unlink(px, idx);
+
+	//An exchange that revalidates the entry fetches the representation again
+	for(i = 0; i < px->maxExchanges; i++){
+		if(px->exchanges[i].active && px->exchanges[i].entry == idx){
+			px->exchanges[i].entry = COAP_PROXY_NIL;
+		}
+	}
+
+	e->used = 0;
+	e->next = px->freeEntries;
+	px->freeEntries = idx;
+}
+
+//Entry of the resource, a new entry replaces the least recently used one when the cache is full
+static uint32_t cache_insert(struct coap_proxy *px, uint64_t devEui, const char *path, uint32_t hash){
+	struct coap_proxy_entry *e;
+	uint32_t idx = cache_find(px, devEui, path, hash);
+
+	if(idx != COAP_PROXY_NIL){
+		return idx;
+	}
+	if(px->freeEntries == COAP_PROXY_NIL){
+		cache_remove(px, px->lruHead);
+	}
+	idx = px->freeEntries;
+	e = &px->entries[idx];
+	px->freeEntries = e->next;
+
+	e->used = 1;
+	e->devEui = devEui;
+	strcpy(e->path, path);
+	e->hash = hash;
+	e->next = px->buckets[hash & px->bucketMask];
+	px->buckets[hash & px->bucketMask] = idx;
+	e->lruPrev = e->lruNext = COAP_PROXY_NIL;
+	if(px->lruTail != COAP_PROXY_NIL) px->entries[px->lruTail].lruNext = idx;
+	else px->lruHead = idx;
+	e->lruPrev = px->lruTail;
+	px->lruTail = idx;
+	return idx;
+}
+
+static void cache_reply(struct coap_proxy *px, void *client, uint32_t idx, const char *ifNoneMatch, uint32_t now){
+	struct coap_proxy_entry *e = &px->entries[idx];
+	struct http_response rsp;
+	char etag[HTTP_ETAG_LEN];
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.status = http_status(e->code);
+	rsp.maxAge = e->expires > now ? e->expires - now : 0;
+	if(e->etagLen != 0){
+		rsp.etag = e->etag;
+		rsp.etagLen = e->etagLen;
+		if(ifNoneMatch != NULL && ifNoneMatch[0] != '\0' && http_format_etag(etag, sizeof(etag), e->etag, e->etagLen) != 0 &&
+				(strcmp(ifNoneMatch, "*") == 0 || strstr(ifNoneMatch, etag) != NULL)){
+			rsp.status = 304;
+			px->reply(px->arg, client, &rsp);
+			return;
+		}
+	}
+	if(e->contentFormat != NO_CONTENT_FORMAT || e->len != 0){
+		rsp.contentType = content_type(e->contentFormat);
+		rsp.body = e->body;
+		rsp.len = e->len;
+	}
+	px->reply(px->arg, client, &rsp);
+}
+
+
+/*
+ * Exchanges
+ */
+
+static uint32_t exchange_find(struct coap_proxy *px, uint64_t devEui, const char *path, uint32_t hash){
+	uint32_t i;
+
+	for(i = 0; i < px->maxExchanges; i++){
+		struct coap_proxy_exchange *x = &px->exchanges[i];
+		if(x->active && x->method == CC_GET && x->hash == hash && x->devEui == devEui && strcmp(x->path, path) == 0){
+			return i;
+		}
+	}
+	return COAP_PROXY_NIL;
+}
+
+static int exchange_wait(struct coap_proxy *px, uint32_t idx, void *client){
+	uint32_t w = px->freeWaiters;
+
+	if(w == COAP_PROXY_NIL){
+		return -1;
+	}
+	px->freeWaiters = px->waiters[w].next;
+	px->waiters[w].client = client;
+	px->waiters[w].next = px->exchanges[idx].waiters;
+	px->exchanges[idx].waiters = w;
+	return 0;
+}
+
+//Answers every waiting client, from the cache entry or with the response, and frees the exchange
+static void exchange_finish(struct coap_proxy *px, uint32_t idx, uint32_t entry, const struct http_response *rsp, uint32_t now){
+	struct coap_proxy_exchange *x = &px->exchanges[idx];
+	uint32_t w, next;
+
+	for(w = x->waiters; w != COAP_PROXY_NIL; w = next){
+		next = px->waiters[w].next;
+		if(entry != COAP_PROXY_NIL){
+			cache_reply(px, px->waiters[w].client, entry, NULL, now);
+		}
+		else{
+			px->reply(px->arg, px->waiters[w].client, rsp);
+		}
+		px->waiters[w].next = px->freeWaiters;
+		px->freeWaiters = w;
+	}
+	x->active = 0;
+	x->waiters = COAP_PROXY_NIL;
+}
+
+//Builds the request and queues it as downlink
+static int exchange_send(struct coap_proxy *px, struct coap_proxy_exchange *x, int32_t contentFormat, const uint8_t *body, size_t len){
+	uint8_t buf[MSG_LEN];
+	coap_pdu pdu = {buf, 0, sizeof(buf), NULL};
+	coap_builder b;
+	const char *path = x->path;
+	size_t n;
+
+	x->mid = px->mid++;
+	coap_builder_init(&b, &pdu, CT_CON, (coap_code)x->method, x->mid, x->token, TOKEN_LEN);
+	while(*path != '\0'){
+		n = strcspn(path, "/");
+		coap_builder_add_option(&b, CON_URI_PATH, (const uint8_t*)path, (uint16_t)n);
+		path += n;
+		if(*path == '/'){
+			path++;
+		}
+	}
+	if(x->entry != COAP_PROXY_NIL){
+		coap_builder_add_option(&b, CON_ETAG, px->entries[x->entry].etag, px->entries[x->entry].etagLen);
+	}
+	if(x->method == CC_PUT){
+		coap_builder_add_uint_option(&b, CON_CONTENT_FORMATt, (uint32_t)contentFormat);
+		coap_builder_set_payload(&b, body, len);
+	}
+	if(coap_builder_finish(&b) != CE_NONE){
+		return -1;
+	}
+
+	px->downlinks++;
+	px->downlink(px->arg, x->devEui, buf, pdu.len);
+	return 0;
+}
+
+static uint32_t exchange_start(struct coap_proxy *px, uint64_t devEui, const char *path, uint32_t hash, uint8_t method, uint32_t now){
+	struct coap_proxy_exchange *x;
+	uint32_t i;
+
+	for(i = 0; i < px->maxExchanges; i++){
+		x = &px->exchanges[i];
+		if(!x->active){
+			x->active = 1;
+			x->devEui = devEui;
+			strcpy(x->path, path);
+			x->hash = hash;
+			x->method = method;
+			x->token = px->token++;
+			x->deadline = now + COAP_PROXY_TIMEOUT;
+			x->entry = COAP_PROXY_NIL;
+			x->waiters = COAP_PROXY_NIL;
+			return i;
+		}
+	}
+	return COAP_PROXY_NIL;
+}
+
+
+/**
+ * Allocates the cache and the exchange tables. maxWaiters is the number of HTTP requests that can wait
+ * for the devices at the same time. Returns 0 on success, -1 when the memory could not be allocated.
+ */
+int coap_proxy_init(struct coap_proxy *px, uint32_t maxEntries, uint32_t maxExchanges, uint32_t maxWaiters,
+		coap_proxy_downlink_fn downlink, coap_proxy_reply_fn reply, void *arg){
+	uint32_t buckets = 1;
+	uint32_t i;
+
+	memset(px, 0, sizeof(*px));
+	if(maxEntries == 0 || maxExchanges == 0 || maxWaiters == 0){
+		return -1;
+	}
+	while(buckets < maxEntries){
+		buckets <<= 1;
+	}
+	px->entries = malloc(maxEntries * sizeof(struct coap_proxy_entry));
+	px->buckets = malloc(buckets * sizeof(uint32_t));
+	px->exchanges = calloc(maxExchanges, sizeof(struct coap_proxy_exchange));
+	px->waiters = malloc(maxWaiters * sizeof(struct coap_proxy_waiter));
+	if(px->entries == NULL || px->buckets == NULL || px->exchanges == NULL || px->waiters == NULL){
+		coap_proxy_free(px);
+		return -1;
+	}
+
+	px->bucketMask = buckets - 1;
+	for(i = 0; i < buckets; i++){
+		px->buckets[i] = COAP_PROXY_NIL;
+	}
+	px->maxEntries = maxEntries;
+	for(i = 0; i < maxEntries; i++){
+		px->entries[i].used = 0;
+		px->entries[i].next = i + 1 < maxEntries ? i + 1 : COAP_PROXY_NIL;
+	}
+	px->freeEntries = 0;
+	px->lruHead = px->lruTail = COAP_PROXY_NIL;
+
+	px->maxExchanges = maxExchanges;
+	px->maxWaiters = maxWaiters;
+	for(i = 0; i < maxWaiters; i++){
+		px->waiters[i].next = i + 1 < maxWaiters ? i + 1 : COAP_PROXY_NIL;
+	}
+	px->freeWaiters = 0;
+
+	px->mid = (uint16_t)rand();
+	px->token = (uint32_t)rand();
+	px->downlink = downlink;
+	px->reply = reply;
+	px->arg = arg;
+	return 0;
+}
+
+void coap_proxy_free(struct coap_proxy *px){
+	free(px->entries);
+	free(px->buckets);
+	free(px->exchanges);
+	free(px->waiters);
+	px->entries = NULL;
+	px->buckets = NULL;
+	px->exchanges = NULL;
+	px->waiters = NULL;
+}
+
+/**
+ * Handles an HTTP request. The client is answered through the reply callback, right away when the
+ * response is in the cache, otherwise when the device answers or the request times out.
+ */
+void coap_proxy_request(struct coap_proxy *px, void *client, const struct http_request *req, uint32_t now){
+	char path[COAP_PROXY_PATH_LEN];
+	uint64_t devEui;
+	uint32_t hash, entry, idx;
+	int32_t contentFormat = 0;
+
+	if(parse_target(req->target, &devEui, path) < 0){
+		reply_status(px, client, 404);
+		return;
+	}
+	hash = key_hash(devEui, path);
+	entry = cache_find(px, devEui, path, hash);
+
+	if(req->method == HTTP_GET){
+		//Fresh response: no downlink
+		if(entry != COAP_PROXY_NIL && (int32_t)(px->entries[entry].expires - now) > 0){
+			px->hits++;
+			lru_touch(px, entry);
+			cache_reply(px, client, entry, req->ifNoneMatch, now);
+			return;
+		}
+
+		//The same request is already queued for the device
+		idx = exchange_find(px, devEui, path, hash);
+		if(idx != COAP_PROXY_NIL){
+			if(exchange_wait(px, idx, client) < 0){
+				reply_status(px, client, 503);
+				return;
+			}
+			px->coalesced++;
+			return;
+		}
+	}
+	else if(req->method == HTTP_PUT){
+		contentFormat = content_format(req->contentType);
+		if(contentFormat < 0){
+			reply_status(px, client, 415);
+			return;
+		}
+		if(req->bodyLen > COAP_PROXY_BODY_LEN){
+			reply_status(px, client, 413);
+			return;
+		}
+		//The representation changes
+		if(entry != COAP_PROXY_NIL){
+			cache_remove(px, entry);
+			entry = COAP_PROXY_NIL;
+		}
+	}
+	else{
+		reply_status(px, client, 405);
+		return;
+	}
+
+	idx = exchange_start(px, devEui, path, hash, req->method == HTTP_GET ? CC_GET : CC_PUT, now);
+	if(idx == COAP_PROXY_NIL || exchange_wait(px, idx, client) < 0){
+		if(idx != COAP_PROXY_NIL){
+			px->exchanges[idx].active = 0;
+		}
+		reply_status(px, client, 503);
+		return;
+	}
+
+	//A stale response with an ETag is revalidated
+	if(entry != COAP_PROXY_NIL && px->entries[entry].etagLen != 0){
+		px->exchanges[idx].entry = entry;
+	}
+	if(exchange_send(px, &px->exchanges[idx], contentFormat, req->body, req->bodyLen) < 0){
+		struct http_response rsp;
+		memset(&rsp, 0, sizeof(rsp));
+		rsp.status = 500;
+		exchange_finish(px, idx, COAP_PROXY_NIL, &rsp, now);
+	}
+}
+
+/**
+ * Handles a CoAP message of a device, the uplink after SCHC decompression.
+ * Messages that do not answer a request of the proxy are ignored.
+ */
+void coap_proxy_input(struct coap_proxy *px, uint64_t devEui, const uint8_t *msg, size_t len, uint32_t now){
+	uint8_t buf[MSG_LEN];
+	coap_option_index index;
+	coap_pdu pdu = {buf, len, sizeof(buf), &index};
+	struct coap_proxy_exchange *x = NULL;
+	struct coap_proxy_entry *e;
+	struct http_response rsp;
+	coap_option option;
+	coap_payload payload;
+	uint32_t i, entry = COAP_PROXY_NIL, maxAge;
+	uint8_t code, type;
+
+	if(len > sizeof(buf)){
+		return;
+	}
+	memcpy(buf, msg, len);
+	if(coap_validate_pkt(&pdu) != CE_NONE){
+		return;
+	}
+	type = coap_get_type(&pdu);
+	code = coap_get_code(&pdu);
+
+	//A confirmable separate response is acknowledged, even when it is a duplicate
+	if(type == CT_CON && code != CC_EMPTY){
+		uint8_t ack[4] = {0x60, 0x00, buf[2], buf[3]};
+		px->downlinks++;
+		px->downlink(px->arg, devEui, ack, sizeof(ack));
+	}
+	//Empty ACK: the response follows separately
+	if(code == CC_EMPTY && type != CT_RST){
+		return;
+	}
+
+	//A reset matches the message ID of the request, a response its token
+	for(i = 0; i < px->maxExchanges; i++){
+		if(px->exchanges[i].active && px->exchanges[i].devEui == devEui &&
+				(type == CT_RST ? coap_get_mid(&pdu) == px->exchanges[i].mid :
+				(coap_get_tkl(&pdu) == TOKEN_LEN && (uint32_t)coap_get_token(&pdu) == px->exchanges[i].token))){
+			x = &px->exchanges[i];
+			break;
+		}
+	}
+	if(x == NULL){
+		return;
+	}
+
+	memset(&rsp, 0, sizeof(rsp));
+	if(type == CT_RST){
+		rsp.status = 502;
+		exchange_finish(px, i, COAP_PROXY_NIL, &rsp, now);
+		return;
+	}
+
+	maxAge = option_uint(&pdu, CON_MAX_AGE, COAP_PROXY_DEFAULT_MAX_AGE);
+
+	//2.03 Valid: the cached representation is fresh again
+	if(code == CC_VALID && x->entry != COAP_PROXY_NIL){
+		entry = x->entry;
+		px->entries[entry].expires = now + maxAge;
+		lru_touch(px, entry);
+		px->revalidated++;
+	}
+	//2.05 Content is cached, when it fits
+	else if(code == CC_CONTENT && x->method == CC_GET && maxAge != 0){
+		payload = coap_get_payload(&pdu);
+		if(payload.len <= COAP_PROXY_BODY_LEN){
+			entry = cache_insert(px, devEui, x->path, x->hash);
+			e = &px->entries[entry];
+			e->code = code;
+			e->expires = now + maxAge;
+			e->contentFormat = (uint16_t)option_uint(&pdu, CON_CONTENT_FORMATt, NO_CONTENT_FORMAT);
+			option = coap_get_option_by_num(&pdu, CON_ETAG, 0);
+			e->etagLen = option.num != 0 && option.len <= COAP_PROXY_ETAG_LEN ? (uint8_t)option.len : 0;
+			memcpy(e->etag, option.val, e->etagLen);
+			e->len = (uint16_t)payload.len;
+			memcpy(e->body, payload.val, payload.len);
+		}
+	}
+
+	if(entry == COAP_PROXY_NIL){
+		//Not cacheable, every waiting client gets the response as it is
+		payload = coap_get_payload(&pdu);
+		rsp.status = http_status(code);
+		if(payload.len != 0){
+			rsp.contentType = content_type((uint16_t)option_uint(&pdu, CON_CONTENT_FORMATt, 0));
+			rsp.body = payload.val;
+			rsp.len = payload.len;
+		}
+	}
+	exchange_finish(px, i, entry, &rsp, now);
+}
+
+/**
+ * Answers the requests that waited longer than COAP_PROXY_TIMEOUT with 504 Gateway Timeout.
+ * Call it periodically, e.g. every second.
+ */
+void coap_proxy_tick(struct coap_proxy *px, uint32_t now){
+	struct http_response rsp;
+	uint32_t i;
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.status = 504;
+	for(i = 0; i < px->maxExchanges; i++){
+		if(px->exchanges[i].active && (int32_t)(now - px->exchanges[i].deadline) >= 0){
+			px->timeouts++;
+			exchange_finish(px, i, COAP_PROXY_NIL, &rsp, now);
+		}
+	}
+}
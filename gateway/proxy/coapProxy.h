@@ -0,0 +1,142 @@
+/**
+ * Gateway-side HTTP-CoAP cross-proxy (RFC 8075) for the LoRaWAN devices.
+ *
+ * Maps HTTP GET and PUT on /<DevEUI>/<Uri-Path> to a confirmable CoAP request toward the device.
+ * A Class A device can only receive a downlink after each of its uplinks, so the proxy spends as
+ * few downlinks as possible:
+ * - GET responses are cached for their Max-Age (60 s when absent) and served from the cache while
+ *   they are fresh, a stale response with an ETag is revalidated with one GET that carries the ETag,
+ *   a 2.03 Valid answer refreshes it without sending the representation again,
+ * - concurrent GETs of the same resource of the same device wait for the one request that is
+ *   already queued, so a dashboard with many viewers costs one downlink,
+ * - the proxy never retransmits, the request stays queued at the network server until the device
+ *   opens its receive windows. A request without an answer within COAP_PROXY_TIMEOUT is answered
+ *   with 504 Gateway Timeout.
+ *
+ * The proxy works on CoAP messages (the UDP payload): the network server compresses the downlinks
+ * and decompresses the uplinks with the SCHC rules of the device, around coap_proxy_input() and the
+ * downlink callback. The messages are encoded and parsed with picocoap (LwIP/apps/picocoap/coap.c).
+ *
+ * All memory is allocated once in coap_proxy_init(). The cache entries are found through a chained
+ * hash table keyed by (DevEUI, Uri-Path), the least recently used entry is replaced when it is full.
+ *
+ * This code runs on the gateway / network server side and only depends on the C standard library.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#ifndef __COAPPROXY_H__
+#define __COAPPROXY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "httpMessage.h"
+
+/** Longest Uri-Path of a resource, segments separated by '/' */
+#ifndef COAP_PROXY_PATH_LEN
+#define COAP_PROXY_PATH_LEN					48
+#endif
+
+/** Largest cached representation and PUT payload, the maximum LoRaWAN FRMPayload */
+#ifndef COAP_PROXY_BODY_LEN
+#define COAP_PROXY_BODY_LEN					242
+#endif
+
+/** Freshness of a response without Max-Age option in s (RFC 7252, section 5.10.5) */
+#ifndef COAP_PROXY_DEFAULT_MAX_AGE
+#define COAP_PROXY_DEFAULT_MAX_AGE			60
+#endif
+
+/** Time in s a request may wait for the device, longer than the uplink period of the devices */
+#ifndef COAP_PROXY_TIMEOUT
+#define COAP_PROXY_TIMEOUT					3600
+#endif
+
+#define COAP_PROXY_ETAG_LEN					8
+#define COAP_PROXY_NIL						0xFFFFFFFFu
+
+/**
+ * Queues a CoAP message as downlink for the device. The message is only valid during the call.
+ */
+typedef void (*coap_proxy_downlink_fn)(void *arg, uint64_t devEui, const uint8_t *msg, size_t len);
+
+/**
+ * Answers the HTTP client that made the request. The response is only valid during the call.
+ */
+typedef void (*coap_proxy_reply_fn)(void *arg, void *client, const struct http_response *rsp);
+
+struct coap_proxy_entry {
+	uint64_t devEui;
+	char path[COAP_PROXY_PATH_LEN];
+	uint32_t hash;
+	uint32_t next;				//Next entry of the same bucket (or free list)
+	uint32_t lruPrev;			//Least recently used list, the head is the oldest
+	uint32_t lruNext;
+	uint32_t expires;			//Time at which the response becomes stale
+	uint8_t used;
+	uint8_t code;
+	uint16_t contentFormat;		//0xFFFF: no Content-Format
+	uint8_t etag[COAP_PROXY_ETAG_LEN];
+	uint8_t etagLen;
+	uint16_t len;
+	uint8_t body[COAP_PROXY_BODY_LEN];
+};
+
+struct coap_proxy_exchange {
+	uint64_t devEui;
+	char path[COAP_PROXY_PATH_LEN];
+	uint32_t hash;
+	uint8_t active;
+	uint8_t method;				//CC_GET or CC_PUT
+	uint16_t mid;
+	uint32_t token;
+	uint32_t deadline;
+	uint32_t entry;				//Cache entry that is revalidated, COAP_PROXY_NIL when none
+	uint32_t waiters;			//First waiting client
+};
+
+struct coap_proxy_waiter {
+	void *client;
+	uint32_t next;
+};
+
+struct coap_proxy {
+	struct coap_proxy_entry *entries;
+	uint32_t *buckets;
+	uint32_t bucketMask;
+	uint32_t maxEntries;
+	uint32_t freeEntries;
+	uint32_t lruHead;
+	uint32_t lruTail;
+
+	struct coap_proxy_exchange *exchanges;
+	uint32_t maxExchanges;
+
+	struct coap_proxy_waiter *waiters;
+	uint32_t maxWaiters;
+	uint32_t freeWaiters;
+
+	uint16_t mid;
+	uint32_t token;
+
+	coap_proxy_downlink_fn downlink;
+	coap_proxy_reply_fn reply;
+	void *arg;
+
+	//Statistics
+	uint32_t hits;				//Served from the cache
+	uint32_t coalesced;			//Joined a request that was already queued
+	uint32_t revalidated;		//Refreshed with 2.03 Valid
+	uint32_t downlinks;
+	uint32_t timeouts;
+};
+
+int coap_proxy_init(struct coap_proxy *px, uint32_t maxEntries, uint32_t maxExchanges, uint32_t maxWaiters,
+		coap_proxy_downlink_fn downlink, coap_proxy_reply_fn reply, void *arg);
+void coap_proxy_free(struct coap_proxy *px);
+void coap_proxy_request(struct coap_proxy *px, void *client, const struct http_request *req, uint32_t now);
+void coap_proxy_input(struct coap_proxy *px, uint64_t devEui, const uint8_t *msg, size_t len, uint32_t now);
+void coap_proxy_tick(struct coap_proxy *px, uint32_t now);
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * Minimal HTTP/1.1 request parser and response writer, see httpMessage.h.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "httpMessage.h"
+
+
+//Case insensitive compare of a header name, the line continues with ':'
+static int header_is(const char *line, size_t len, const char *name){
+	size_t n = strlen(name);
+	size_t i;
+
+	if(len <= n || line[n] != ':'){
+		return 0;
+	}
+	for(i = 0; i < n; i++){
+		if(tolower((unsigned char)line[i]) != tolower((unsigned char)name[i])){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//Copies the value of a header line without the surrounding white space
+static void header_value(const char *line, size_t len, size_t nameLen, char *out, size_t max){
+	const char *v = line + nameLen + 1;
+	const char *end = line + len;
+
+	while(v < end && (*v == ' ' || *v == '\t')){
+		v++;
+	}
+	while(end > v && (end[-1] == ' ' || end[-1] == '\t')){
+		end--;
+	}
+	if((size_t)(end - v) >= max){
+		end = v + max - 1;
+	}
+	memcpy(out, v, end - v);
+	out[end - v] = '\0';
+}
+
+static const char *status_text(int status){
+	switch(status){
+	case 200: return "OK";
+	case 201: return "Created";
+	case 204: return "No Content";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 401: return "Unauthorized";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 406: return "Not Acceptable";
+	case 412: return "Precondition Failed";
+	case 413: return "Payload Too Large";
+	case 415: return "Unsupported Media Type";
+	case 500: return "Internal Server Error";
+	case 501: return "Not Implemented";
+	case 502: return "Bad Gateway";
+	case 503: return "Service Unavailable";
+	case 504: return "Gateway Timeout";
+	default: return "Unknown";
+	}
+}
+
+/**
+ * Parses one request. The body is not copied, it points into buf.
+ * Returns the number of bytes of the request, 0 when it is not complete yet, -1 when it is malformed.
+ */
+int http_parse_request(const char *buf, size_t len, struct http_request *req){
+	const char *end, *line, *eol, *sp;
+	size_t contentLength = 0;
+	char value[24];
+	size_t n;
+
+	memset(req, 0, sizeof(*req));
+
+	//The header ends with an empty line
+	for(end = buf; end + 4 <= buf + len; end++){
+		if(memcmp(end, "\r\n\r\n", 4) == 0){
+			break;
+		}
+	}
+	if(end + 4 > buf + len){
+		return 0;
+	}
+
+	//Request line: method SP target SP version
+	eol = memchr(buf, '\r', end + 2 - buf);
+	sp = memchr(buf, ' ', eol - buf);
+	if(sp == NULL){
+		return -1;
+	}
+	if(sp - buf == 3 && memcmp(buf, "GET", 3) == 0){
+		req->method = HTTP_GET;
+	}
+	else if(sp - buf == 3 && memcmp(buf, "PUT", 3) == 0){
+		req->method = HTTP_PUT;
+	}
+	line = sp + 1;
+	sp = memchr(line, ' ', eol - line);
+	if(sp == NULL || (size_t)(sp - line) >= HTTP_TARGET_LEN || eol - sp < 9 || memcmp(sp + 1, "HTTP/1.", 7) != 0){
+		return -1;
+	}
+	memcpy(req->target, line, sp - line);
+	req->target[sp - line] = '\0';
+
+	//Header lines
+	for(line = eol + 2; line < end + 2; line = eol + 2){
+		eol = memchr(line, '\r', end + 2 - line);
+		n = eol - line;
+		if(header_is(line, n, "Content-Length")){
+			header_value(line, n, 14, value, sizeof(value));
+			if(value[0] < '0' || value[0] > '9' || strlen(value) > 9){
+				return -1;
+			}
+			contentLength = strtoul(value, NULL, 10);
+		}
+		else if(header_is(line, n, "Content-Type")){
+			header_value(line, n, 12, req->contentType, sizeof(req->contentType));
+		}
+		else if(header_is(line, n, "If-None-Match")){
+			header_value(line, n, 13, req->ifNoneMatch, sizeof(req->ifNoneMatch));
+		}
+	}
+
+	n = end + 4 - buf;
+	if(len < n + contentLength){
+		return 0;
+	}
+	req->body = (const uint8_t*)end + 4;
+	req->bodyLen = contentLength;
+	return (int)(n + contentLength);
+}
+
+/**
+ * Writes the quoted hex form of an ETag, e.g. "0a1b". Returns its length, 0 when it does not fit.
+ */
+size_t http_format_etag(char *buf, size_t max, const uint8_t *etag, uint8_t etagLen){
+	static const char hex[] = "0123456789abcdef";
+	size_t n = 0;
+	uint8_t i;
+
+	if(max < 2 * (size_t)etagLen + 3){
+		return 0;
+	}
+	buf[n++] = '"';
+	for(i = 0; i < etagLen; i++){
+		buf[n++] = hex[etag[i] >> 4];
+		buf[n++] = hex[etag[i] & 0x0F];
+	}
+	buf[n++] = '"';
+	buf[n] = '\0';
+	return n;
+}
+
+/**
+ * Writes the status line, the headers and the body of a response.
+ * Returns the length, 0 when it does not fit in max.
+ */
+size_t http_format_response(char *buf, size_t max, const struct http_response *rsp){
+	char etag[HTTP_ETAG_LEN];
+	size_t bodyLen = rsp->contentType != NULL ? rsp->len : 0;
+	int n;
+
+	n = snprintf(buf, max, "HTTP/1.1 %d %s\r\nContent-Length: %u\r\n", rsp->status, status_text(rsp->status), (unsigned)bodyLen);
+	if(n > 0 && (size_t)n < max && rsp->contentType != NULL){
+		n += snprintf(buf + n, max - n, "Content-Type: %s\r\n", rsp->contentType);
+	}
+	if(n > 0 && (size_t)n < max && rsp->etag != NULL && http_format_etag(etag, sizeof(etag), rsp->etag, rsp->etagLen) != 0){
+		n += snprintf(buf + n, max - n, "ETag: %s\r\n", etag);
+	}
+	if(n > 0 && (size_t)n < max){
+		if(rsp->maxAge != 0){
+			n += snprintf(buf + n, max - n, "Cache-Control: max-age=%lu\r\n\r\n", (unsigned long)rsp->maxAge);
+		}
+		else{
+			n += snprintf(buf + n, max - n, "Cache-Control: no-cache\r\n\r\n");
+		}
+	}
+	if(n <= 0 || (size_t)n >= max || (size_t)n + bodyLen > max){
+		return 0;
+	}
+	if(bodyLen != 0){
+		memcpy(buf + n, rsp->body, bodyLen);
+	}
+	return (size_t)n + bodyLen;
+}
@@ -0,0 +1,52 @@
+/**
+ * Minimal HTTP/1.1 request parser and response writer for the HTTP-CoAP proxy.
+ *
+ * Only what the proxy needs: the request line, Content-Length, Content-Type and If-None-Match.
+ * The socket handling stays with the web server of the network server, it hands the received
+ * bytes to http_parse_request() and sends what http_format_response() wrote.
+ *
+ * This code runs on the gateway / network server side and only depends on the C standard library.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#ifndef __HTTPMESSAGE_H__
+#define __HTTPMESSAGE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HTTP_TARGET_LEN						128
+#define HTTP_CONTENT_TYPE_LEN				64
+#define HTTP_ETAG_LEN						40		//quoted hex string of an 8 byte ETag, or "*"
+
+typedef enum http_method {
+	HTTP_OTHER = 0,
+	HTTP_GET,
+	HTTP_PUT
+} http_method;
+
+struct http_request {
+	http_method method;
+	char target[HTTP_TARGET_LEN];
+	char contentType[HTTP_CONTENT_TYPE_LEN];
+	char ifNoneMatch[HTTP_ETAG_LEN];			//empty when the header is absent
+	const uint8_t *body;						//points into the parsed buffer
+	size_t bodyLen;
+};
+
+struct http_response {
+	int status;
+	const char *contentType;					//NULL: no body
+	const uint8_t *body;
+	size_t len;
+	const uint8_t *etag;						//NULL: no ETag header
+	uint8_t etagLen;
+	uint32_t maxAge;							//seconds of freshness left, 0: no-cache
+};
+
+int http_parse_request(const char *buf, size_t len, struct http_request *req);
+size_t http_format_response(char *buf, size_t max, const struct http_response *rsp);
+size_t http_format_etag(char *buf, size_t max, const uint8_t *etag, uint8_t etagLen);
+
+#endif
@@ -0,0 +1,457 @@
+/**
+ * Gateway-side SCHC reassembly manager, see schcReassembly.h for the fragment format.
+ *
+ * All memory is allocated once in schc_rsm_init(), processing a fragment never allocates:
+ * - sessions live in a fixed pool and are found through an open-addressed (linear probing) hash table,
+ * - tiles are taken from a slab with a free list,
+ * - every session is linked in the slot of the timer wheel that matches its inactivity deadline,
+ *   so expiring and finding the oldest session does not need a sorted structure.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "schcReassembly.h"
+
+#define WHEEL_MASK			(SCHC_RSM_WHEEL_SLOTS - 1)
+#define LAST_TILE_INDEX		(SCHC_FRAG_MAX_TILES - 1)
+
+static uint32_t crc32Table[256];
+
+
+static void crc32_init(void){
+	uint32_t i, j, c;
+
+	for(i = 0; i < 256; i++){
+		c = i;
+		for(j = 0; j < 8; j++){
+			c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+		}
+		crc32Table[i] = c;
+	}
+}
+
+static uint32_t crc32(const uint8_t *buf, size_t len){
+	uint32_t c = 0xFFFFFFFFu;
+
+	while(len--){
+		c = crc32Table[(c ^ *buf++) & 0xFF] ^ (c >> 8);
+	}
+	return c ^ 0xFFFFFFFFu;
+}
+
+//64 bit mix (splitmix64 finalizer) of the session key
+static uint32_t key_hash(uint64_t devEui, uint8_t ruleId, uint8_t dtag){
+	uint64_t x = devEui ^ (((uint64_t)ruleId << 8 | dtag) * 0x9E3779B97F4A7C15ull);
+
+	x ^= x >> 30;
+	x *= 0xBF58476D1CE4E5B9ull;
+	x ^= x >> 27;
+	x *= 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return (uint32_t)x;
+}
+
+
+/*
+ * Hash table
+ */
+
+//Returns the bucket holding the session, or the empty bucket where it has to be inserted.
+static uint32_t table_find(struct schc_rsm *rsm, uint64_t devEui, uint8_t ruleId, uint8_t dtag, uint32_t hash){
+	uint32_t b = hash & rsm->tableMask;
+	struct schc_rsm_session *s;
+
+	while(rsm->table[b].session != SCHC_RSM_NIL){
+		if(rsm->table[b].hash == hash){
+			s = &rsm->sessions[rsm->table[b].session];
+			if(s->devEui == devEui && s->ruleId == ruleId && s->dtag == dtag){
+				return b;
+			}
+		}
+		b = (b + 1) & rsm->tableMask;
+	}
+	return b;
+}
+
+//Backward shift deletion, keeps the probe sequences intact without tombstones.
+static void table_remove(struct schc_rsm *rsm, uint32_t b){
+	uint32_t next = (b + 1) & rsm->tableMask;
+	uint32_t home;
+
+	while(rsm->table[next].session != SCHC_RSM_NIL){
+		home = rsm->table[next].hash & rsm->tableMask;
+
+		//Move the entry back if its home bucket is not in (b, next]
+		if(((next - home) & rsm->tableMask) >= ((next - b) & rsm->tableMask)){
+			rsm->table[b] = rsm->table[next];
+			b = next;
+		}
+		next = (next + 1) & rsm->tableMask;
+	}
+	rsm->table[b].session = SCHC_RSM_NIL;
+}
+
+
+/*
+ * Timer wheel
+ */
+
+static void wheel_unlink(struct schc_rsm *rsm, uint32_t idx){
+	struct schc_rsm_session *s = &rsm->sessions[idx];
+	uint32_t slot = s->deadline & WHEEL_MASK;
+
+	if(s->wheelPrev != SCHC_RSM_NIL){
+		rsm->sessions[s->wheelPrev].wheelNext = s->wheelNext;
+	}
+	else{
+		rsm->wheel[slot] = s->wheelNext;
+	}
+	if(s->wheelNext != SCHC_RSM_NIL){
+		rsm->sessions[s->wheelNext].wheelPrev = s->wheelPrev;
+	}
+	else{
+		rsm->wheelTail[slot] = s->wheelPrev;
+	}
+}
+
+//Sessions are added at the tail of their slot, so the head of a slot holds the oldest session.
+static void wheel_link(struct schc_rsm *rsm, uint32_t idx, uint32_t deadline){
+	struct schc_rsm_session *s = &rsm->sessions[idx];
+	uint32_t slot = deadline & WHEEL_MASK;
+
+	s->deadline = deadline;
+	s->wheelNext = SCHC_RSM_NIL;
+	s->wheelPrev = rsm->wheelTail[slot];
+	if(s->wheelPrev != SCHC_RSM_NIL){
+		rsm->sessions[s->wheelPrev].wheelNext = idx;
+	}
+	else{
+		rsm->wheel[slot] = idx;
+	}
+	rsm->wheelTail[slot] = idx;
+}
+
+
+/*
+ * Sessions
+ */
+
+static void session_release(struct schc_rsm *rsm, uint32_t idx){
+	struct schc_rsm_session *s = &rsm->sessions[idx];
+	uint32_t t, next;
+
+	//Give the tiles back to the slab
+	for(t = s->tiles; t != SCHC_RSM_NIL; t = next){
+		next = rsm->tiles[t].next;
+		rsm->tiles[t].next = rsm->freeTiles;
+		rsm->freeTiles = t;
+		rsm->usedTiles--;
+	}
+
+	table_remove(rsm, table_find(rsm, s->devEui, s->ruleId, s->dtag, s->hash));
+	wheel_unlink(rsm, idx);
+
+	s->wheelNext = rsm->freeSessions;
+	rsm->freeSessions = idx;
+	rsm->activeSessions--;
+}
+
+//Evicts the session with the earliest deadline (the one that has been inactive the longest).
+static int evict_oldest(struct schc_rsm *rsm, uint32_t keep){
+	uint32_t i, oldest;
+
+	for(i = 0; i < SCHC_RSM_WHEEL_SLOTS; i++){
+		oldest = rsm->wheel[(rsm->now + i) & WHEEL_MASK];
+		if(oldest == keep && oldest != SCHC_RSM_NIL){
+			oldest = rsm->sessions[oldest].wheelNext;
+		}
+		if(oldest != SCHC_RSM_NIL){
+			session_release(rsm, oldest);
+			rsm->evicted++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//Copies the tiles in order to the assembly buffer and checks the RCS.
+static size_t session_assemble(struct schc_rsm *rsm, struct schc_rsm_session *s, uint32_t regular){
+	struct schc_rsm_tile *tile;
+	size_t len = (size_t)regular * s->tileSize;
+	size_t total = len;
+	uint32_t t;
+
+	for(t = s->tiles; t != SCHC_RSM_NIL; t = tile->next){
+		tile = &rsm->tiles[t];
+		if(tile->index == LAST_TILE_INDEX){
+			memcpy(rsm->assembly + len, tile->data, tile->len);
+			total += tile->len;
+		}
+		else{
+			memcpy(rsm->assembly + (size_t)tile->index * s->tileSize, tile->data, tile->len);
+		}
+	}
+
+	return crc32(rsm->assembly, total) == s->rcs ? total : 0;
+}
+
+
+/**
+ * Allocates all memory of the reassembly manager.
+ *
+ * @param rsm The reassembly manager
+ * @param memBudget Memory in bytes available for the sessions, the hash table and the tiles
+ * @param complete Called for every reassembled packet
+ * @param arg Passed to the completion callback
+ *
+ * @return 0 on success, -1 when the budget is too small or the allocation failed
+ */
+int schc_rsm_init(struct schc_rsm *rsm, size_t memBudget, schc_rsm_complete_fn complete, void *arg){
+	uint32_t i, tableSize;
+	size_t sessionCost = sizeof(struct schc_rsm_session) + 2 * sizeof(struct schc_rsm_bucket);
+
+	memset(rsm, 0, sizeof(*rsm));
+	crc32_init();
+
+	//A quarter of the budget for the session state, the rest for the tiles
+	rsm->maxSessions = (uint32_t)((memBudget / 4) / sessionCost);
+	rsm->maxTiles = (uint32_t)((memBudget - (memBudget / 4)) / sizeof(struct schc_rsm_tile));
+	if(rsm->maxSessions == 0 || rsm->maxTiles < SCHC_FRAG_MAX_TILES){
+		return -1;
+	}
+
+	//Load factor of the table stays below 0.5
+	for(tableSize = 1; tableSize < 2 * rsm->maxSessions; tableSize <<= 1);
+	rsm->tableMask = tableSize - 1;
+
+	rsm->table = malloc(tableSize * sizeof(struct schc_rsm_bucket));
+	rsm->sessions = malloc(rsm->maxSessions * sizeof(struct schc_rsm_session));
+	rsm->tiles = malloc(rsm->maxTiles * sizeof(struct schc_rsm_tile));
+	rsm->assembly = malloc(SCHC_FRAG_MAX_TILES * SCHC_RSM_TILE_SIZE);
+	if(!rsm->table || !rsm->sessions || !rsm->tiles || !rsm->assembly){
+		schc_rsm_free(rsm);
+		return -1;
+	}
+
+	for(i = 0; i < tableSize; i++){
+		rsm->table[i].session = SCHC_RSM_NIL;
+	}
+	for(i = 0; i < rsm->maxSessions; i++){
+		rsm->sessions[i].wheelNext = i + 1 < rsm->maxSessions ? i + 1 : SCHC_RSM_NIL;
+	}
+	for(i = 0; i < rsm->maxTiles; i++){
+		rsm->tiles[i].next = i + 1 < rsm->maxTiles ? i + 1 : SCHC_RSM_NIL;
+	}
+	for(i = 0; i < SCHC_RSM_WHEEL_SLOTS; i++){
+		rsm->wheel[i] = SCHC_RSM_NIL;
+		rsm->wheelTail[i] = SCHC_RSM_NIL;
+	}
+
+	rsm->freeSessions = 0;
+	rsm->freeTiles = 0;
+	rsm->complete = complete;
+	rsm->arg = arg;
+
+	return 0;
+}
+
+void schc_rsm_free(struct schc_rsm *rsm){
+	free(rsm->table);
+	free(rsm->sessions);
+	free(rsm->tiles);
+	free(rsm->assembly);
+	memset(rsm, 0, sizeof(*rsm));
+}
+
+/**
+ * Advances the timer wheel and drops the sessions that were inactive for SCHC_RSM_INACTIVITY_TICKS.
+ * schc_rsm_input() also calls this, the gateway only has to call it when no fragments arrive.
+ *
+ * @param rsm The reassembly manager
+ * @param now Current time in ticks
+ */
+void schc_rsm_tick(struct schc_rsm *rsm, uint32_t now){
+	uint32_t steps = now - rsm->now;
+	uint32_t i, idx, next;
+
+	if(steps > SCHC_RSM_WHEEL_SLOTS){
+		steps = SCHC_RSM_WHEEL_SLOTS;
+	}
+
+	for(i = 0; i <= steps; i++){
+		for(idx = rsm->wheel[(rsm->now + i) & WHEEL_MASK]; idx != SCHC_RSM_NIL; idx = next){
+			next = rsm->sessions[idx].wheelNext;
+			if((int32_t)(rsm->sessions[idx].deadline - now) <= 0){
+				session_release(rsm, idx);
+				rsm->expired++;
+			}
+		}
+	}
+	rsm->now = now;
+}
+
+/**
+ * Processes one uplink FRMPayload of a device.
+ *
+ * @param rsm The reassembly manager
+ * @param devEui DevEUI of the device that sent the frame
+ * @param frame The FRMPayload, starting with the RuleID
+ * @param len Length of the FRMPayload
+ * @param now Current time in ticks
+ *
+ * @return schc_rsm_status
+ */
+schc_rsm_status schc_rsm_input(struct schc_rsm *rsm, uint64_t devEui, const uint8_t *frame, size_t len, uint32_t now){
+	struct schc_rsm_session *s;
+	struct schc_rsm_tile *tile;
+	uint32_t hash, b, idx, t, regular;
+	uint8_t dtag, fcn, index;
+	const uint8_t *tileData;
+	size_t tileLen, total;
+
+	if(len < 1){
+		return SCHC_RSM_INVALID;
+	}
+
+	//Packet was not fragmented, hand it over to the decompressor
+	if(frame[0] != SCHC_FRAG_RULEID){
+		rsm->complete(rsm->arg, devEui, frame, len);
+		rsm->delivered++;
+		return SCHC_RSM_COMPLETE;
+	}
+
+	if(len < SCHC_FRAG_HDR_LEN){
+		return SCHC_RSM_INVALID;
+	}
+
+	if(now != rsm->now){
+		schc_rsm_tick(rsm, now);
+	}
+
+	dtag = frame[1];
+	fcn = frame[2] & SCHC_FRAG_FCN_MASK;
+
+	if(fcn == SCHC_FRAG_FCN_ALL1){
+		if(len < SCHC_FRAG_HDR_LEN + SCHC_FRAG_RCS_LEN){
+			return SCHC_RSM_INVALID;
+		}
+		index = LAST_TILE_INDEX;
+		tileData = frame + SCHC_FRAG_HDR_LEN + SCHC_FRAG_RCS_LEN;
+		tileLen = len - SCHC_FRAG_HDR_LEN - SCHC_FRAG_RCS_LEN;
+	}
+	else{
+		if(fcn > SCHC_FRAG_MAX_WIND_FCN || len == SCHC_FRAG_HDR_LEN){
+			return SCHC_RSM_INVALID;
+		}
+		index = SCHC_FRAG_MAX_WIND_FCN - fcn;
+		tileData = frame + SCHC_FRAG_HDR_LEN;
+		tileLen = len - SCHC_FRAG_HDR_LEN;
+	}
+
+	if(tileLen > SCHC_RSM_TILE_SIZE){
+		return SCHC_RSM_INVALID;
+	}
+
+	//Find or open the session
+	hash = key_hash(devEui, frame[0], dtag);
+	b = table_find(rsm, devEui, frame[0], dtag, hash);
+
+	if(rsm->table[b].session != SCHC_RSM_NIL){
+		idx = rsm->table[b].session;
+		s = &rsm->sessions[idx];
+		wheel_unlink(rsm, idx);
+	}
+	else{
+		if(rsm->freeSessions == SCHC_RSM_NIL){
+			if(!evict_oldest(rsm, SCHC_RSM_NIL)){
+				return SCHC_RSM_NO_MEMORY;
+			}
+			//The eviction may have shifted the probe sequence
+			b = table_find(rsm, devEui, frame[0], dtag, hash);
+		}
+		idx = rsm->freeSessions;
+		s = &rsm->sessions[idx];
+		rsm->freeSessions = s->wheelNext;
+		rsm->activeSessions++;
+
+		s->devEui = devEui;
+		s->ruleId = frame[0];
+		s->dtag = dtag;
+		s->tileSize = 0;
+		s->gotLast = 0;
+		s->rcs = 0;
+		s->bitmap = 0;
+		s->tiles = SCHC_RSM_NIL;
+		s->nTiles = 0;
+		s->hash = hash;
+
+		rsm->table[b].hash = hash;
+		rsm->table[b].session = idx;
+	}
+
+	//Every fragment, also a duplicate, restarts the inactivity timer
+	wheel_link(rsm, idx, now + SCHC_RSM_INACTIVITY_TICKS);
+
+	if(index == LAST_TILE_INDEX){
+		if(s->gotLast){
+			return SCHC_RSM_DUPLICATE;
+		}
+	}
+	else{
+		if(s->bitmap & (1ull << index)){
+			return SCHC_RSM_DUPLICATE;
+		}
+		//All regular tiles have the same size
+		if(s->tileSize == 0){
+			s->tileSize = (uint8_t)tileLen;
+		}
+		else if(s->tileSize != tileLen){
+			return SCHC_RSM_INVALID;
+		}
+	}
+
+	//Store the tile
+	if(rsm->freeTiles == SCHC_RSM_NIL && !evict_oldest(rsm, idx)){
+		return SCHC_RSM_NO_MEMORY;
+	}
+	t = rsm->freeTiles;
+	tile = &rsm->tiles[t];
+	rsm->freeTiles = tile->next;
+	rsm->usedTiles++;
+
+	tile->index = index;
+	tile->len = (uint8_t)tileLen;
+	memcpy(tile->data, tileData, tileLen);
+	tile->next = s->tiles;
+	s->tiles = t;
+	s->nTiles++;
+
+	if(index == LAST_TILE_INDEX){
+		s->gotLast = 1;
+		s->rcs = (uint32_t)frame[3] << 24 | (uint32_t)frame[4] << 16 | (uint32_t)frame[5] << 8 | frame[6];
+	}
+	else{
+		s->bitmap |= 1ull << index;
+	}
+
+	//Complete when the last tile is received and the regular tiles 0..n-1 have no gaps.
+	//A failing RCS means tiles at the end of the train are still missing.
+	if(!s->gotLast || (s->bitmap & (s->bitmap + 1)) != 0){
+		return SCHC_RSM_OK;
+	}
+
+	regular = s->nTiles - 1;
+	total = session_assemble(rsm, s, regular);
+	if(total == 0){
+		return SCHC_RSM_OK;
+	}
+
+	rsm->complete(rsm->arg, devEui, rsm->assembly, total);
+	rsm->delivered++;
+	session_release(rsm, idx);
+
+	return SCHC_RSM_COMPLETE;
+}
@@ -0,0 +1,133 @@
+/**
+ * Gateway-side SCHC reassembly manager.
+ *
+ * Reassembles the SCHC fragment trains of many devices at the same time. Sessions are kept in an
+ * open-addressed hash table keyed by (DevEUI, RuleID, DTag), the tiles are stored in a slab that is
+ * allocated once at startup and a timer wheel expires inactive sessions. When the tile slab or the
+ * session pool is exhausted the session that has been inactive the longest is evicted first,
+ * so memory stays bounded when a device floods partial trains.
+ *
+ * A completed packet (or a packet that was not fragmented) is handed to the completion callback.
+ * That packet starts with the compression RuleID and is fed to the same decompressor as schc_input().
+ *
+ * This code runs on the gateway / network server side and only depends on the C standard library.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#ifndef __SCHCREASSEMBLY_H__
+#define __SCHCREASSEMBLY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Fragment format (one window, No-ACK mode):
+ *
+ *   | RuleID (8) | DTag (8) | W (1) | reserved (1) | FCN (6) | tile ... |
+ *
+ * The FCN counts down from SCHC_FRAG_MAX_WIND_FCN for the first fragment. The last fragment uses
+ * FCN All-1 and carries the 32 bit Reassembly Check Sequence (CRC32 of the full SCHC packet, big endian)
+ * in front of the last tile. Every other fragment carries exactly one tile of the same size.
+ */
+#define SCHC_FRAG_RULEID					0xF0	//RuleID reserved for fragmented packets
+#define SCHC_FRAG_HDR_LEN					3
+#define SCHC_FRAG_RCS_LEN					4
+#define SCHC_FRAG_FCN_MASK					0x3F
+#define SCHC_FRAG_FCN_ALL1					0x3F
+#define SCHC_FRAG_MAX_WIND_FCN				62
+#define SCHC_FRAG_MAX_TILES					(SCHC_FRAG_MAX_WIND_FCN + 2)	//62..0 plus the All-1 tile
+
+/** Largest tile, the maximum LoRaWAN FRMPayload */
+#ifndef SCHC_RSM_TILE_SIZE
+#define SCHC_RSM_TILE_SIZE					242
+#endif
+
+/** Number of slots of the inactivity timer wheel, must be a power of 2 */
+#ifndef SCHC_RSM_WHEEL_SLOTS
+#define SCHC_RSM_WHEEL_SLOTS				256
+#endif
+
+/** Inactivity timeout in ticks, must be smaller than SCHC_RSM_WHEEL_SLOTS */
+#ifndef SCHC_RSM_INACTIVITY_TICKS
+#define SCHC_RSM_INACTIVITY_TICKS			120
+#endif
+
+#define SCHC_RSM_NIL						0xFFFFFFFFu
+
+typedef enum schc_rsm_status {
+	SCHC_RSM_OK = 0,			//Fragment stored, train not complete yet
+	SCHC_RSM_COMPLETE,			//Packet delivered to the completion callback
+	SCHC_RSM_DUPLICATE,			//Tile was already received
+	SCHC_RSM_INVALID,			//Malformed fragment
+	SCHC_RSM_NO_MEMORY			//Nothing could be evicted to store the fragment
+} schc_rsm_status;
+
+/**
+ * Called for every reassembled packet. The packet buffer is only valid during the call.
+ */
+typedef void (*schc_rsm_complete_fn)(void *arg, uint64_t devEui, const uint8_t *packet, size_t len);
+
+struct schc_rsm_tile {
+	uint32_t next;				//Next tile of the same session
+	uint8_t index;				//Position of the tile in the packet
+	uint8_t len;
+	uint8_t data[SCHC_RSM_TILE_SIZE];
+};
+
+struct schc_rsm_session {
+	uint64_t devEui;
+	uint8_t ruleId;
+	uint8_t dtag;
+	uint8_t tileSize;			//Size of the regular tiles, learned from the first regular fragment
+	uint8_t gotLast;
+	uint32_t rcs;
+	uint64_t bitmap;			//bit i set = regular tile i received
+	uint32_t tiles;				//First tile in the slab
+	uint32_t nTiles;
+	uint32_t hash;
+	uint32_t deadline;			//Tick at which the session expires
+	uint32_t wheelPrev;			//Doubly linked list of the timer wheel slot (or free list)
+	uint32_t wheelNext;
+};
+
+struct schc_rsm_bucket {
+	uint32_t hash;
+	uint32_t session;			//SCHC_RSM_NIL when empty
+};
+
+struct schc_rsm {
+	struct schc_rsm_bucket *table;
+	uint32_t tableMask;
+
+	struct schc_rsm_session *sessions;
+	uint32_t maxSessions;
+	uint32_t freeSessions;
+	uint32_t activeSessions;
+
+	struct schc_rsm_tile *tiles;
+	uint32_t maxTiles;
+	uint32_t freeTiles;
+	uint32_t usedTiles;
+
+	uint32_t wheel[SCHC_RSM_WHEEL_SLOTS];		//Oldest session of every slot
+	uint32_t wheelTail[SCHC_RSM_WHEEL_SLOTS];	//Newest session of every slot
+	uint32_t now;
+
+	uint8_t *assembly;			//Output buffer for one complete packet
+
+	schc_rsm_complete_fn complete;
+	void *arg;
+
+	//Statistics
+	uint32_t evicted;
+	uint32_t expired;
+	uint32_t delivered;
+};
+
+int schc_rsm_init(struct schc_rsm *rsm, size_t memBudget, schc_rsm_complete_fn complete, void *arg);
+void schc_rsm_free(struct schc_rsm *rsm);
+schc_rsm_status schc_rsm_input(struct schc_rsm *rsm, uint64_t devEui, const uint8_t *frame, size_t len, uint32_t now);
+void schc_rsm_tick(struct schc_rsm *rsm, uint32_t now);
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * Gateway-side decoder of the compressed temperature batches, see seriesDecode.h.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#include "seriesDecode.h"
+
+struct bit_reader {
+	const uint8_t *buf;
+	size_t pos;			//in bits
+	size_t max;			//in bits
+};
+
+static int get_bits(struct bit_reader *r, uint8_t n, uint32_t *value){
+	if(r->pos + n > r->max){
+		return -1;
+	}
+	*value = 0;
+	while(n--){
+		*value = (*value << 1) | ((r->buf[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+		r->pos++;
+	}
+	return 0;
+}
+
+static int32_t unzigzag(uint32_t value){
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+//Number of 1 bits in front of the first 0, at most max (the last prefix has no 0)
+static int get_prefix(struct bit_reader *r, uint8_t max, uint8_t *ones){
+	uint32_t bit;
+
+	for(*ones = 0; *ones < max; (*ones)++){
+		if(get_bits(r, 1, &bit) < 0){
+			return -1;
+		}
+		if(bit == 0){
+			break;
+		}
+	}
+	return 0;
+}
+
+static int get_dod(struct bit_reader *r, int32_t *dod){
+	static const uint8_t width[] = {0, 7, 9, 12, 32};
+	uint32_t zz = 0;
+	uint8_t ones;
+
+	if(get_prefix(r, 4, &ones) < 0 || get_bits(r, width[ones], &zz) < 0){
+		return -1;
+	}
+	*dod = unzigzag(zz);
+	return 0;
+}
+
+static int get_delta(struct bit_reader *r, int32_t *delta){
+	static const uint8_t width[] = {0, 4, 8, 17};
+	uint32_t zz = 0;
+	uint8_t ones;
+
+	if(get_prefix(r, 3, &ones) < 0 || get_bits(r, width[ones], &zz) < 0){
+		return -1;
+	}
+	*delta = unzigzag(zz);
+	return 0;
+}
+
+int series_decode(const uint8_t *buf, size_t len, struct series_point *points, size_t max){
+	struct bit_reader r = {buf, 0, len * 8};
+	uint32_t count, age0, value0;
+	int32_t dod, step, delta = 0, value, rel = 0;
+	uint32_t i;
+
+	if(get_bits(&r, 8, &count) < 0 || get_bits(&r, 24, &age0) < 0 || get_bits(&r, 16, &value0) < 0){
+		return -1;
+	}
+	if(count == 0 || count > max){
+		return -1;
+	}
+
+	value = (int16_t)value0;
+	points[0].age = (int32_t)age0;
+	points[0].value = (int16_t)value;
+
+	for(i = 1; i < count; i++){
+		if(get_dod(&r, &dod) < 0){
+			return -1;
+		}
+		delta += dod;
+		rel += delta;
+		if(get_delta(&r, &step) < 0){
+			return -1;
+		}
+		value += step;
+		points[i].age = (int32_t)age0 - rel;
+		points[i].value = (int16_t)value;
+	}
+	return (int)count;
+}
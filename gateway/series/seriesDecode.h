@@ -0,0 +1,47 @@
+/**
+ * Gateway-side decoder of the compressed temperature batches.
+ *
+ * The device (LwIP/apps/picocoap/coapSeries.c) packs its sample history into a bit stream, MSB first:
+ * delta-of-delta timestamps and zig-zag value deltas with a variable length prefix. The payload of the
+ * CoAP PUT to /temp with Content-Format 42 (application/octet-stream) is decoded here, bit for bit
+ * the inverse of series_encode().
+ *
+ *   Header:  count (8) | age of the first sample in s (24) | first value (16, signed)
+ *   Sample:  time    0                delta-of-delta 0
+ *                    10   + 7 bits    zig-zag delta-of-delta
+ *                    110  + 9 bits
+ *                    1110 + 12 bits
+ *                    1111 + 32 bits
+ *            value   0                same value
+ *                    10   + 4 bits    zig-zag delta
+ *                    110  + 8 bits
+ *                    111  + 17 bits
+ *
+ * The time of a sample is in s relative to the first sample, the delta of the first sample is 0.
+ * The padding bits of the last byte are ignored.
+ *
+ * This code runs on the gateway / network server side and only depends on the C standard library.
+ *
+ * author: Tomas Bolckmans
+ */
+
+#ifndef __SERIESDECODE_H__
+#define __SERIESDECODE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SERIES_MAX_SAMPLES					255
+
+struct series_point {
+	int32_t age;		//seconds before the uplink was sent
+	int16_t value;
+};
+
+/*
+ * Decodes one batch into points (oldest first), max is the number of points that fit.
+ * Returns the number of points, or -1 when the payload is truncated or holds more than max points.
+ */
+int series_decode(const uint8_t *buf, size_t len, struct series_point *points, size_t max);
+
+#endif
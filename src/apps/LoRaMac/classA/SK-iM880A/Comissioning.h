@@ -73,4 +73,24 @@ Maintainer: Miguel Luis and Gregory Cristian
  */
 #define LORAWAN_APPSKEY                             { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C }
 
+/*!
+ * Multicast session shared by the devices of the group, set up on the network server
+ */
+#define LORAWAN_MULTICAST_ADDRESS                   ( uint32_t )0x26011F00
+
+/*!
+ * AES encryption/decryption cipher network session key of the multicast session
+ */
+#define LORAWAN_MULTICAST_NWKSKEY                   { 0x3C, 0x4F, 0xCF, 0x09, 0x88, 0x15, 0xF7, 0xAB, 0xA6, 0xD2, 0xAE, 0x28, 0x16, 0x15, 0x7E, 0x2B }
+
+/*!
+ * AES encryption/decryption cipher application session key of the multicast session
+ */
+#define LORAWAN_MULTICAST_APPSKEY                   { 0x3C, 0x4F, 0xCF, 0x09, 0x88, 0x15, 0xF7, 0xAB, 0xA6, 0xD2, 0xAE, 0x28, 0x16, 0x15, 0x7E, 0x2B }
+
+/*!
+ * IPv6 multicast group of the multicast session: ff05::fd, All CoAP Nodes (site-local)
+ */
+#define LORAWAN_MULTICAST_GROUP                     { 0xFF, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFD }
+
 #endif // __LORA_COMMISSIONING_H__
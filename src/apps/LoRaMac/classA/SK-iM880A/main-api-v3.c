@@ -14,6 +14,7 @@ Maintainer: Andreas Pella (IMST GmbH), Miguel Luis and Gregory Cristian
 */
 #include <string.h>
 #include <math.h>
+#include <stdlib.h>
 #include "board.h"
 
 #include "LoRaMac-api-v3.h"
@@ -46,6 +47,11 @@ Maintainer: Andreas Pella (IMST GmbH), Miguel Luis and Gregory Cristian
 #include "apps/udpecho_raw/udpecho_raw.h"
 #include "apps/picocoap/coap.h"
 #include "apps/picocoap/coapClient.h"
+#include "apps/picocoap/coapRtt.h"
+#include "apps/picocoap/coapServer.h"
+#include "apps/picocoap/coapBlock.h"
+#include "apps/picocoap/coapSenml.h"
+#include "apps/picocoap/coapSeries.h"
 
 
 /*!
@@ -76,6 +82,22 @@ Maintainer: Andreas Pella (IMST GmbH), Miguel Luis and Gregory Cristian
  */
 #define LORAWAN_ADR_ON                              1
 
+/*!
+ * LoRaWAN class C: the receiver stays open, downlinks for the IPv6 stack are
+ * received without waiting for the next uplink.
+ *
+ * \remark Only for mains-powered end-devices
+ */
+#define LORAWAN_CLASS_C_ON                          0
+
+/*!
+ * LoRaWAN multicast session bound to an IPv6 group, the CoAP server answers the
+ * group requests (e.g. a configuration change for all the devices in one downlink).
+ *
+ * \remark Multicast downlinks are sent in the receive windows of class C (or B)
+ */
+#define LORAWAN_MULTICAST_ON                        0
+
 #if defined( USE_BAND_868 )
 
 /*!
@@ -101,6 +123,24 @@ Maintainer: Andreas Pella (IMST GmbH), Miguel Luis and Gregory Cristian
 
 #endif
 
+/*!
+ * Change of the temperature (degrees) that triggers an Observe notification
+ */
+#define TEMPERATURE_NOTIFY_THRESHOLD                1
+
+/*!
+ * The temperature is measured every TEMPERATURE_SAMPLE_PERIOD s, the samples are sent
+ * once they fill the frame at the current datarate (TemperatureBatchFull)
+ */
+#define TEMPERATURE_SAMPLE_PERIOD                   1200
+
+/*!
+ * Encoding of the batched samples: compressed time series (1) or SenML/CBOR (0),
+ * SenML fits TEMPERATURE_SENML_SAMPLES in one frame at the slowest datarate
+ */
+#define TEMPERATURE_SERIES_ON                       1
+#define TEMPERATURE_SENML_SAMPLES                   3
+
 /*!
  * LoRaWAN application port
  *
@@ -174,11 +214,22 @@ static uint8_t IsTxConfirmed = LORAWAN_CONFIRMED_MSG_ON;
  */
 static uint32_t TxDutyCycleTime;
 
+/*!
+ * Application data transmission duty cycle, can be changed with PUT /config/interval
+ */
+static uint32_t AppTxDutyCycle = APP_TX_DUTYCYCLE;
+
 /*!
  * Timer to handle the application data transmission duty cycle
  */
 static TimerEvent_t TxNextPacketTimer;
 
+/*!
+ * Timer to measure the temperature
+ */
+static TimerEvent_t TemperatureSampleTimer;
+volatile bool TemperatureSampleDue = false;
+
 #if( OVER_THE_AIR_ACTIVATION != 0 )
 
 /*!
@@ -195,6 +246,28 @@ static bool TxNextPacket = true;
 static bool ScheduleNextTx = false;
 static bool DownlinkStatusUpdate = false;
 
+#if( LORAWAN_CLASS_C_ON == 1 )
+/*!
+ * Indicates if the MAC has switched to class C
+ */
+static bool IsClassCActive = false;
+#endif
+
+#if( LORAWAN_MULTICAST_ON == 1 )
+/*!
+ * Multicast session of the group
+ */
+static MulticastParams_t MulticastSession =
+{
+    .Address = LORAWAN_MULTICAST_ADDRESS,
+    .NwkSKey = LORAWAN_MULTICAST_NWKSKEY,
+    .AppSKey = LORAWAN_MULTICAST_APPSKEY,
+    .DownLinkCounter = 0,
+    .Next = NULL
+};
+static const uint8_t MulticastGroup[16] = LORAWAN_MULTICAST_GROUP;
+#endif
+
 static LoRaMacCallbacks_t LoRaMacCallbacks;
 
 static TimerEvent_t Led4Timer;
@@ -230,10 +303,182 @@ struct netif virtualloraif;
 struct netif schcCompressor;
 char msg[]="t";
 
+/*!
+ * Last measured temperature and the temperature of the last Observe notification
+ */
+static int16_t Temperature;
+static int16_t NotifiedTemperature;
+
+/*!
+ * \brief   GET /sensors/temp: the last temperature, in plain text
+ */
+static coap_code OnGetTemperature( coap_pdu *request, coap_pdu *response )
+{
+    uint8_t text[6];
+    uint8_t len = 0;
+    uint16_t value = ( Temperature < 0 ) ? -Temperature : Temperature;
+
+    do
+    {
+        text[sizeof( text ) - 1 - len++] = '0' + value % 10;
+        value /= 10;
+    }while( value != 0 );
+    if( Temperature < 0 )
+    {
+        text[sizeof( text ) - 1 - len++] = '-';
+    }
+    coap_set_payload( response, &text[sizeof( text ) - len], len );
+    return CC_CONTENT;
+}
+
+/*!
+ * \brief   GET /sensors/vdd: the supply voltage in mV, in plain text. The response is cached,
+ *          the ADC is only read again after the next temperature sample.
+ */
+static coap_code OnGetVdd( coap_pdu *request, coap_pdu *response )
+{
+    uint8_t text[5];
+    uint8_t len = 0;
+    uint16_t value = BoardMeasureVdd( );
+
+    do
+    {
+        text[sizeof( text ) - 1 - len++] = '0' + value % 10;
+        value /= 10;
+    }while( value != 0 );
+    coap_set_payload( response, &text[sizeof( text ) - len], len );
+    return CC_CONTENT;
+}
+
+/*!
+ * \brief   GET and PUT /config/interval: the transmission duty cycle in ms, in plain text
+ */
+static coap_code OnInterval( coap_pdu *request, coap_pdu *response )
+{
+    uint8_t text[10];
+    uint8_t len = 0;
+    uint32_t value;
+    coap_payload payload;
+
+    if( coap_get_code( request ) == CC_PUT )
+    {
+        payload = coap_get_payload( request );
+        if( payload.len == 0 || payload.len > 7 )
+        {
+            return CC_BAD_REQUEST;
+        }
+        value = 0;
+        while( len < payload.len )
+        {
+            if( payload.val[len] < '0' || payload.val[len] > '9' )
+            {
+                return CC_BAD_REQUEST;
+            }
+            value = value * 10 + payload.val[len++] - '0';
+        }
+        if( value < APP_TX_DUTYCYCLE_RND )
+        {
+            return CC_BAD_REQUEST;
+        }
+        AppTxDutyCycle = value;
+        return CC_CHANGED;
+    }
+
+    value = AppTxDutyCycle;
+    do
+    {
+        text[sizeof( text ) - 1 - len++] = '0' + value % 10;
+        value /= 10;
+    }while( value != 0 );
+    coap_set_payload( response, &text[sizeof( text ) - len], len );
+    return CC_CONTENT;
+}
+
+/*!
+ * Temperature samples that wait to be sent, and the number of them in the last uplink
+ */
+static series_ring TemperatureSeries;
+static uint8_t TemperatureSent;
+
+#if( TEMPERATURE_SERIES_ON == 1 )
+/*!
+ * \brief   Packs as many temperature samples as fit into the outgoing message
+ */
+static size_t WriteTemperatureSeries( void *arg, uint8_t *buf, size_t max )
+{
+    return series_encode( &TemperatureSeries, TimerGetCurrentTime( ), buf, max, &TemperatureSent );
+}
+
+/*!
+ * \brief   Checks whether the waiting samples fill the frame at the current datarate
+ *
+ * \retval  true when more samples wait than fit in the frame, or when the ring is full
+ */
+static bool TemperatureBatchFull( void )
+{
+    uint8_t count = series_count( &TemperatureSeries );
+    uint8_t fit = 0;
+
+    if( count == 0 )
+    {
+        return false;
+    }
+    series_encode( &TemperatureSeries, TimerGetCurrentTime( ), NULL,
+                   coap_output_room( "temp", COAP_CF_OCTET_STREAM ), &fit );
+    return ( fit < count ) || ( count == COAP_SERIES_LEN );
+}
+#else
+/*!
+ * \brief   Writes the oldest temperature samples as SenML/CBOR into the outgoing message
+ */
+static size_t WriteTemperatureSenml( void *arg, uint8_t *buf, size_t max )
+{
+    senml_sample temp[TEMPERATURE_SENML_SAMPLES];
+    TimerTime_t now = TimerGetCurrentTime( );
+    size_t len = 0;
+    uint8_t n;
+
+    for( n = 0; n < TEMPERATURE_SENML_SAMPLES && n < series_count( &TemperatureSeries ); n++ )
+    {
+        temp[n].value = series_get( &TemperatureSeries, n )->value;
+        temp[n].age = ( now - series_get( &TemperatureSeries, n )->time ) / 1000;
+    }
+    //Fewer samples when they do not fit in the frame
+    while( n > 0 && ( len = senml_encode( buf, max, "temp", "Cel", temp, n ) ) == 0 )
+    {
+        n--;
+    }
+    TemperatureSent = n;
+    return len;
+}
+
+/*!
+ * \brief   Checks whether the waiting samples fill the frame
+ *
+ * \retval  true when TEMPERATURE_SENML_SAMPLES are waiting
+ */
+static bool TemperatureBatchFull( void )
+{
+    return series_count( &TemperatureSeries ) >= TEMPERATURE_SENML_SAMPLES;
+}
+#endif
+
+/*!
+ * Resources of the CoAP server of the device
+ */
+static coap_resource CoapResources[] =
+{
+    { "sensors/temp", COAP_METHOD_GET | COAP_OBSERVABLE | COAP_CACHEABLE, COAP_CF_TEXT_PLAIN, OnGetTemperature, TEMPERATURE_SAMPLE_PERIOD, 0 },
+    { "sensors/vdd", COAP_METHOD_GET | COAP_CACHEABLE, COAP_CF_TEXT_PLAIN, OnGetVdd, TEMPERATURE_SAMPLE_PERIOD, 0 },
+    { "config/interval", COAP_METHOD_GET | COAP_METHOD_PUT | COAP_CACHEABLE, COAP_CF_TEXT_PLAIN, OnInterval, 0, 0 },
+};
+
 /*!
  * \brief   Prepares the payload of the frame
+ *
+ * \retval  true when AppData holds a frame to send
  */
-static void PrepareTxFrame( uint8_t ApplicatiePort )
+static bool PrepareTxFrame( uint8_t ApplicatiePort )
 {
     switch( ApplicatiePort )
     {
@@ -258,20 +503,25 @@ static void PrepareTxFrame( uint8_t ApplicatiePort )
         break;
     case 10:
       {
-    	  //Get the 3 temperature samples from the sensor (temperature is measured every 20 minutes)
-    	  //and the 3 temp values are sent in a batch.
-    	  uint8_t temp[6];
-    	  temp[0] = (uint8_t) "2";  //example value: 28 degrees
-    	  temp[1] = (uint8_t) "8";
-    	  temp[2] = (uint8_t) "2";  //example value: 29 degrees
-    	  temp[3] = (uint8_t) "9";
-    	  temp[4] = (uint8_t) "2";  //example value: 29 degrees
-    	  temp[5] = (uint8_t) "9";
-
-    	  //Send CoAP Message to Application Server
-    	  coap_output(temp);
+    	  //The temperature samples are measured every 20 minutes and sent in a batch with their age,
+    	  //once they fill the frame at the current datarate. The samples that did not fit are sent
+    	  //with the next batch. Nothing is queued here otherwise, the main loop re-arms the timer.
+    	  //When the temperature is observed the notifications are sent when a sample is measured,
+    	  //otherwise the samples are sent with a PUT to the Application Server.
+    	  //virtualloraif sends the uplink itself.
+    	  if( !coap_server_observed( &CoapResources[0] ) && TemperatureBatchFull( ) )
+    	  {
+#if( TEMPERATURE_SERIES_ON == 1 )
+    		  if( coap_output( "temp", COAP_CF_OCTET_STREAM, WriteTemperatureSeries, NULL ) == 0 )
+#else
+    		  if( coap_output( "temp", COAP_CF_SENML_CBOR, WriteTemperatureSenml, NULL ) == 0 )
+#endif
+    		  {
+    			  series_drop( &TemperatureSeries, TemperatureSent );
+    		  }
+    	  }
         }
-        break;
+        return false;
     case 224:
         if( ComplianceTest.LinkCheck == true )
         {
@@ -300,6 +550,7 @@ static void PrepareTxFrame( uint8_t ApplicatiePort )
     default:
         break;
     }
+    return true;
 }
 
 static void ProcessRxFrame( LoRaMacEventFlags_t *flags, LoRaMacEventInfo_t *info )
@@ -317,19 +568,12 @@ static void ProcessRxFrame( LoRaMacEventFlags_t *flags, LoRaMacEventInfo_t *info
     case 10:
     	//IPv6 Pakket ontvangen in de payload!!
 
-        AppDataSize = info->RxBufferSize;
-
-        uint8_t i;
-
-        //Payload van ontvangen pakket in AppData plaatsen
-        for(i = 0; i < AppDataSize; i++ )
-        {
-            AppData[i] = info->RxBuffer[i];   //waarom hier +1???
-        }
-
-        virtualloraif_input(&virtualloraif);
+        //The payload is passed to lwIP without copying it, a multicast frame goes to its IPv6 group
+        schc_rx_address( info->RxAddress );
+        virtualloraif_input(&virtualloraif, info->RxBuffer, info->RxBufferSize);
 
         //Downlink LED wordt ergens anders getoggled.
+        break;
 
     case 224:
         if( ComplianceTest.Running == false )
@@ -455,6 +699,15 @@ static void OnTxNextPacketTimerEvent( void )
     TxNextPacket = true;
 }
 
+/*!
+ * \brief Function executed on TemperatureSample Timeout event
+ */
+static void OnTemperatureSampleTimerEvent( void )
+{
+    TimerStop( &TemperatureSampleTimer );
+    TemperatureSampleDue = true;
+}
+
 /*!
  * \brief Function executed on Led 4 Timeout event
  */
@@ -489,6 +742,15 @@ static void OnMacEvent( LoRaMacEventFlags_t *flags, LoRaMacEventInfo_t *info )
     {
         if( flags->Bits.Tx == 1 )
         {
+            // The uplink is sent, release it in the virtualloraif queue
+            virtualloraif_tx_done( &virtualloraif );
+
+            // Time on air of the uplink and the off time the duty cycle imposes after it,
+            // bound the CoAP retransmission timeout
+            coap_rtt_link_update( info->TxTimeOnAir, info->TxTimeOff, 0, 0 );
+
+            // Room in the next frame (ADR may have changed the datarate), sizes the CoAP blocks
+            coap_block_link_update( virtualloraif_max_payload( &virtualloraif ) );
         }
 
         if( flags->Bits.Rx == 1 )
@@ -509,6 +771,15 @@ static void OnMacEvent( LoRaMacEventFlags_t *flags, LoRaMacEventInfo_t *info )
                 ProcessRxFrame( flags, info );
             }
 
+            // Link quality of the downlink, the radio reports the SNR in quarter dB
+            coap_rtt_link_update( 0, 0, info->RxRssi, ( ( int8_t )info->RxSnr ) >> 2 );
+
+            if( info->RxFramePending == true )
+            {
+                // The network server has more downlinks, virtualloraif fetches them with the next uplink
+                virtualloraif_frame_pending( &virtualloraif );
+            }
+
             DownlinkStatusUpdate = true;
             TimerStart( &Led2Timer );
         }
@@ -550,11 +821,6 @@ int interface_init(){
  */
 int main( void ){
 
-	lwip_init(); //Initialize LwIP stack
-	interface_init();  //Initialize all interfaces (schc_interface, UDP and schc interface
-	udp_coap_pcpb_init(); //setup ipv6/udp/coap connection
-
-
 #if( OVER_THE_AIR_ACTIVATION != 0 )
     uint8_t sendFrameStatus = 0;
 #endif
@@ -563,6 +829,14 @@ int main( void ){
     BoardInitMcu( );
     BoardInitPeriph( );
 
+    // Random seed initialization, before the CoAP message IDs, tokens and backoffs are drawn
+    srand1( BoardGetRandomSeed( ) );
+
+    lwip_init( ); //Initialize LwIP stack
+    interface_init( );  //Initialize all interfaces (schc_interface, UDP and schc interface
+    udp_coap_pcpb_init( ); //setup ipv6/udp/coap connection
+    coap_server_init( CoapResources, sizeof( CoapResources ) / sizeof( CoapResources[0] ) );
+
     LoRaMacCallbacks.MacEvent = OnMacEvent;
     LoRaMacCallbacks.GetBatteryLevel = BoardGetBatteryLevel;
     LoRaMacInit( &LoRaMacCallbacks );
@@ -572,9 +846,6 @@ int main( void ){
 #if( OVER_THE_AIR_ACTIVATION == 0 )
     if( DevAddr == 0 )
     {
-        // Random seed initialization
-        srand1( BoardGetRandomSeed( ) );
-
         // Choose a random device address
         DevAddr = randr( 0, 0x01FFFFFF );
     }
@@ -590,9 +861,25 @@ int main( void ){
     TimerSetValue( &JoinReqTimer, OVER_THE_AIR_ACTIVATION_DUTYCYCLE );
 #endif
 
+#if( LORAWAN_MULTICAST_ON == 1 )
+    ip6_addr_t group;
+
+    // The packets of the multicast session go to the IPv6 group, the CoAP server handles the group requests
+    memcpy( group.addr, MulticastGroup, sizeof( MulticastGroup ) );
+    LoRaMacMulticastChannelAdd( &MulticastSession );
+    schc_group_bind( &virtualloraif, LORAWAN_MULTICAST_ADDRESS, &group );
+#endif
+
     TxNextPacket = true;
     TimerInit( &TxNextPacketTimer, OnTxNextPacketTimerEvent );
 
+    series_init( &TemperatureSeries );
+    Temperature = BoardMeasureTemperature( );
+    NotifiedTemperature = Temperature;
+    TimerInit( &TemperatureSampleTimer, OnTemperatureSampleTimerEvent );
+    TimerSetValue( &TemperatureSampleTimer, TEMPERATURE_SAMPLE_PERIOD * 1000 );
+    TimerStart( &TemperatureSampleTimer );
+
     TimerInit( &Led4Timer, OnLed4TimerEvent );
     TimerSetValue( &Led4Timer, 25 );
 
@@ -648,6 +935,14 @@ int main( void ){
 #endif
         }
 
+#if( LORAWAN_CLASS_C_ON == 1 )
+        // Switch to class C once the network is joined, the MAC refuses it while transmitting
+        if( IsClassCActive == false )
+        {
+            IsClassCActive = ( virtualloraif_set_device_class( &virtualloraif, CLASS_C ) == ERR_OK );
+        }
+#endif
+
         //Toggles van de LEDs, als een led aan stond zetten ze het bij elke nieuwe while iteratie terug uit.
         //LED4 is de oranje verzend LED (meest rechts) = D4
         //LED1 is de meest linkse led = D1
@@ -668,6 +963,23 @@ int main( void ){
             Led3StateChanged = false;
             GpioWrite( &Led3, ( ( AppLedStateOn & 0x01 ) != 0 ) ? 1 : 0 );
         }
+        if( TemperatureSampleDue == true )
+        {
+            TemperatureSampleDue = false;
+            TimerStart( &TemperatureSampleTimer );
+            Temperature = BoardMeasureTemperature( );
+            series_add( &TemperatureSeries, TimerGetCurrentTime( ), Temperature );
+            //New readings: the cached GET responses are built again
+            coap_server_invalidate( &CoapResources[0] );
+            coap_server_invalidate( &CoapResources[1] );
+            //The observers only get a notification when the temperature changed enough
+            if( coap_server_observed( &CoapResources[0] ) &&
+                ( abs( Temperature - NotifiedTemperature ) >= TEMPERATURE_NOTIFY_THRESHOLD ) )
+            {
+                NotifiedTemperature = Temperature;
+                coap_server_notify( &CoapResources[0] );
+            }
+        }
         if( DownlinkStatusUpdate == true )
         {
             DownlinkStatusUpdate = false;
@@ -686,7 +998,7 @@ int main( void ){
             else
             {
                 // Schedule next packet transmission
-                TxDutyCycleTime = APP_TX_DUTYCYCLE + randr( -APP_TX_DUTYCYCLE_RND, APP_TX_DUTYCYCLE_RND );
+                TxDutyCycleTime = AppTxDutyCycle + randr( -APP_TX_DUTYCYCLE_RND, APP_TX_DUTYCYCLE_RND );
                 TimerSetValue( &TxNextPacketTimer, TxDutyCycleTime );
                 TimerStart( &TxNextPacketTimer );
             }
@@ -699,18 +1011,33 @@ int main( void ){
             trySendingFrameAgain = SendFrame( );
         }
 
+        //Retransmits the confirmable CoAP messages that are not acknowledged in time
+        coap_client_poll( );
+
+        //Sends the response to a group request when its leisure is over
+        coap_server_poll( );
+
+        //Sends the packets that are still waiting in the virtualloraif queue
+        virtualloraif_poll( &virtualloraif );
+
         //Tries to send the frame
         if( TxNextPacket == true )
         {
             TxNextPacket = false;
 
-            PrepareTxFrame( AppPort );
-            
-            // Switch LED 4 ON
-            GpioWrite( &Led4, 1 );
-            TimerStart( &Led4Timer );
+            if( PrepareTxFrame( AppPort ) == true )
+            {
+                // Switch LED 4 ON
+                GpioWrite( &Led4, 1 );
+                TimerStart( &Led4Timer );
 
-            trySendingFrameAgain = SendFrame( );
+                trySendingFrameAgain = SendFrame( );
+            }
+            else
+            {
+                // No LoRaMAC frame, OnMacEvent will not schedule the next one
+                ScheduleNextTx = true;
+            }
         }
 
         TimerLowPowerHandler( );
@@ -62,10 +62,8 @@ udpecho_raw_recv(void *arg, struct udp_pcb *upcb, struct pbuf *p,
   if (p != NULL) {
     /* send received packet back to sender */
 
-  //!!!!!! Echo server op sensor staat uit!!! Werkt wel => hij kopieert echodata in AppData MAAR er moet dan nog een trigger gemaakt worden in virtualloraif die dan ook onmiddelijk verzend
-  //dit is er nu niet en daardoor verzend hij gewoon om de 10 seconden zijn gewoonlijke pakketten.
-
-	  //udp_sendto(upcb, p, addr, port);
+  //virtualloraif queues the echo and sends the uplink immediately, it does not wait for the application timer.
+	  udp_sendto(upcb, p, addr, port);
 
     /* free the pbuf */
     pbuf_free(p);
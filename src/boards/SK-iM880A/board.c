@@ -26,6 +26,14 @@ Maintainer: Andreas Pella (IMST GmbH), Miguel Luis and Gregory Cristian
 #define PDDADC_VREF_BANDGAP                             1224 // mV
 #define PDDADC_MAX_VALUE                                4096
 
+/*!
+ * Factory calibration of the internal temperature sensor ( STM32L1xxx cat. 1 and 2 ),
+ * ADC readings at 30 and 110 degrees with VDDA = 3 V
+ */
+#define TS_CAL1                                         ( *( uint16_t * )0x1FF8007A )
+#define TS_CAL2                                         ( *( uint16_t * )0x1FF8007E )
+#define TS_CAL_VDD                                      3000 // mV
+
 /*!
  * Battery level ratio (battery dependent)
  */
@@ -224,6 +232,18 @@ uint16_t BoardMeasureVdd( void )
     return ( uint16_t ) milliVolt;
 }
 
+int16_t BoardMeasureTemperature( void )
+{
+    int32_t measuredLevel = 0;
+
+    // Read the internal sensor, scaled to the VDDA of the calibration
+    measuredLevel = AdcMcuRead( &Adc , ADC_CHANNEL_TEMPSENSOR );
+    measuredLevel = measuredLevel * BoardMeasureVdd( ) / TS_CAL_VDD;
+
+    // Straight line through the two calibration points
+    return ( int16_t )( 30 + ( measuredLevel - TS_CAL1 ) * ( 110 - 30 ) / ( TS_CAL2 - TS_CAL1 ) );
+}
+
 uint8_t BoardGetBatteryLevel( void )
 {
     uint8_t batteryLevel = 0;
@@ -162,6 +162,13 @@ uint8_t BoardMeasurePotiLevel( void );
  */
 uint16_t BoardMeasureVdd( void );
 
+/*!
+ * \brief Measure the temperature with the internal sensor of the MCU
+ *
+ * \retval value  Temperature in degrees Celsius
+ */
+int16_t BoardMeasureTemperature( void );
+
 /*!
  * \brief Get the current battery level
  *
@@ -56,6 +56,8 @@ static void McpsConfirm( McpsConfirm_t *mcpsConfirm )
     LoRaMacEventInfo.TxDatarate = mcpsConfirm->Datarate;
     LoRaMacEventInfo.TxNbRetries = mcpsConfirm->NbRetries;
     LoRaMacEventInfo.TxAckReceived = mcpsConfirm->AckReceived;
+    LoRaMacEventInfo.TxTimeOnAir = mcpsConfirm->TxTimeOnAir;
+    LoRaMacEventInfo.TxTimeOff = mcpsConfirm->TxTimeOff;
 
     if( ( LoRaMacFlags.Bits.McpsInd != 1 ) && ( LoRaMacFlags.Bits.MlmeReq != 1 ) )
     {
@@ -82,10 +84,12 @@ static void McpsIndication( McpsIndication_t *mcpsIndication )
     }
 
     LoRaMacEventInfo.RxPort = mcpsIndication->Port;
+    LoRaMacEventInfo.RxAddress = mcpsIndication->DevAddress;
     LoRaMacEventInfo.RxBuffer = mcpsIndication->Buffer;
     LoRaMacEventInfo.RxBufferSize = mcpsIndication->BufferSize;
     LoRaMacEventInfo.RxRssi = mcpsIndication->Rssi;
     LoRaMacEventInfo.RxSnr = mcpsIndication->Snr;
+    LoRaMacEventInfo.RxFramePending = mcpsIndication->FramePending;
 
     LoRaMacCallbacks.MacEvent( &LoRaMacEventFlags, &LoRaMacEventInfo );
     LoRaMacEventFlags.Value = 0;
@@ -161,11 +161,15 @@ typedef struct
     bool TxAckReceived;
     uint8_t TxNbRetries;
     uint8_t TxDatarate;
+    TimerTime_t TxTimeOnAir;
+    TimerTime_t TxTimeOff;
     uint8_t RxPort;
+    uint32_t RxAddress;
     uint8_t *RxBuffer;
     uint8_t RxBufferSize;
     int16_t RxRssi;
     uint8_t RxSnr;
+    bool RxFramePending;
     uint16_t Energy;
     uint8_t DemodMargin;
     uint8_t NbGateways;
@@ -825,6 +825,16 @@ static uint16_t RetransmissionDutyCylce( void );
  */
 static void CalculateBackOff( uint8_t channel );
 
+/*
+ * \brief Calculates the time the duty cycle keeps the device off after the
+ *        frame that was sent on a channel, as CalculateBackOff will apply it.
+ *
+ * \param [IN] channel     The last Tx channel index
+ *
+ * \retval Time off in ms
+ */
+static TimerTime_t CalculateTimeOff( uint8_t channel );
+
 /*
  * \brief Alternates the datarate of the channel for the join request.
  *
@@ -867,6 +877,8 @@ static void OnRadioTxDone( void )
     Bands[Channels[LastTxChannel].Band].LastTxDoneTime = curTime;
     // Update Aggregated last tx done time
     AggregatedLastTxDoneTime = curTime;
+    // Time until the duty cycle allows the next frame
+    McpsConfirm.TxTimeOff = CalculateTimeOff( LastTxChannel );
 
     if( IsRxWindowsEnabled == true )
     {
@@ -958,6 +970,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
     McpsIndication.RxSlot = RxSlot;
     McpsIndication.Port = 0;
     McpsIndication.Multicast = 0;
+    McpsIndication.DevAddress = 0;
     McpsIndication.FramePending = 0;
     McpsIndication.Buffer = NULL;
     McpsIndication.BufferSize = 0;
@@ -1140,6 +1153,7 @@ static void OnRadioRxDone( uint8_t *payload, uint16_t size, int16_t rssi, int8_t
                 {
                     McpsIndication.Status = LORAMAC_EVENT_INFO_STATUS_OK;
                     McpsIndication.Multicast = multicast;
+                    McpsIndication.DevAddress = address;
                     McpsIndication.FramePending = fCtrl.Bits.FPending;
                     McpsIndication.Buffer = NULL;
                     McpsIndication.BufferSize = 0;
@@ -1404,6 +1418,7 @@ static void OnMacStateCheckTimerEvent( void )
                 McpsConfirm.NbRetries = AckTimeoutRetriesCounter;
                 McpsConfirm.AckReceived = false;
                 McpsConfirm.TxTimeOnAir = 0;
+                McpsConfirm.TxTimeOff = 0;
                 txTimeout = true;
             }
         }
@@ -2757,6 +2772,27 @@ static void CalculateBackOff( uint8_t channel )
     AggregatedTimeOff = AggregatedTimeOff + ( TxTimeOnAir * AggregatedDCycle - TxTimeOnAir );
 }
 
+static TimerTime_t CalculateTimeOff( uint8_t channel )
+{
+    uint16_t dutyCycle = Bands[Channels[channel].Band].DCycle;
+    TimerTime_t bandTimeOff = 0;
+    TimerTime_t aggregatedTimeOff = 0;
+
+    if( IsLoRaMacNetworkJoined == false )
+    {
+        dutyCycle = MAX( dutyCycle, RetransmissionDutyCylce( ) );
+    }
+    if( DutyCycleOn == true )
+    {
+        bandTimeOff = TxTimeOnAir * dutyCycle - TxTimeOnAir;
+    }
+    if( MaxDCycle != 0 )
+    {
+        aggregatedTimeOff = AggregatedTimeOff + ( TxTimeOnAir * AggregatedDCycle - TxTimeOnAir );
+    }
+    return MAX( bandTimeOff, aggregatedTimeOff );
+}
+
 static int8_t AlternateDatarate( uint16_t nbTrials )
 {
     int8_t datarate = LORAMAC_TX_MIN_DATARATE;
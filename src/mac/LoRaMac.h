@@ -834,6 +834,11 @@ typedef struct sMcpsConfirm
      * The transmission time on air of the frame
      */
     TimerTime_t TxTimeOnAir;
+    /*!
+     * Time the duty cycle keeps the device off after the frame, 0 when
+     * the duty cycle is not enforced
+     */
+    TimerTime_t TxTimeOff;
     /*!
      * The uplink counter value related to the frame
      */
@@ -857,6 +862,11 @@ typedef struct sMcpsIndication
      * Multicast
      */
     uint8_t Multicast;
+    /*!
+     * Device address of the frame, the address of the multicast channel
+     * when Multicast is set
+     */
+    uint32_t DevAddress;
     /*!
      * Application port
      */
@@ -670,38 +670,27 @@ uint32_t SX1272GetTimeOnAir( RadioModems_t modem, uint8_t pktLen )
         break;
     case MODEM_LORA:
         {
-            double bw = 0.0;
-            switch( SX1272.Settings.LoRa.Bandwidth )
+            // Integer only, the MCU has no FPU. Gives the same result as the floating
+            // point formula: ceil of the payload symbols, time rounded up to ms with
+            // floor( t + 0.999 ).
+
+            // Time for one symbol in us: 2^SF / BW, BW = 125 kHz << Bandwidth
+            uint32_t ts = ( uint32_t )1 << ( SX1272.Settings.LoRa.Datarate + 3 - SX1272.Settings.LoRa.Bandwidth );
+            // Symbol length of payload
+            int32_t num = 8 * pktLen - 4 * ( int32_t )SX1272.Settings.LoRa.Datarate +
+                          28 + 16 * SX1272.Settings.LoRa.CrcOn -
+                          ( SX1272.Settings.LoRa.FixLen ? 20 : 0 );
+            int32_t den = 4 * ( int32_t )SX1272.Settings.LoRa.Datarate -
+                          ( ( SX1272.Settings.LoRa.LowDatarateOptimize > 0 ) ? 2 : 0 );
+            uint32_t nPayload = 8;
+            if( num > 0 )
             {
-            case 0: // 125 kHz
-                bw = 125e3;
-                break;
-            case 1: // 250 kHz
-                bw = 250e3;
-                break;
-            case 2: // 500 kHz
-                bw = 500e3;
-                break;
+                nPayload += ( ( num + den - 1 ) / den ) * ( SX1272.Settings.LoRa.Coderate + 4 );
             }
-
-            // Symbol rate : time for one symbol (secs)
-            double rs = bw / ( 1 << SX1272.Settings.LoRa.Datarate );
-            double ts = 1 / rs;
-            // time of preamble
-            double tPreamble = ( SX1272.Settings.LoRa.PreambleLen + 4.25 ) * ts;
-            // Symbol length of payload and time
-            double tmp = ceil( ( 8 * pktLen - 4 * SX1272.Settings.LoRa.Datarate +
-                                 28 + 16 * SX1272.Settings.LoRa.CrcOn -
-                                 ( SX1272.Settings.LoRa.FixLen ? 20 : 0 ) ) /
-                                 ( double )( 4 * SX1272.Settings.LoRa.Datarate -
-                                 ( ( SX1272.Settings.LoRa.LowDatarateOptimize > 0 ) ? 2 : 0 ) ) ) *
-                                 ( SX1272.Settings.LoRa.Coderate + 4 );
-            double nPayload = 8 + ( ( tmp > 0 ) ? tmp : 0 );
-            double tPayload = nPayload * ts;
-            // Time on air
-            double tOnAir = tPreamble + tPayload;
-            // return us secs
-            airTime = floor( tOnAir * 1e3 + 0.999 );
+            // Time on air in quarter symbols, the preamble is PreambleLen + 4.25 symbols
+            uint32_t quarters = 4 * SX1272.Settings.LoRa.PreambleLen + 17 + 4 * nPayload;
+            // ms = quarters * ts / 4000, ts is a multiple of 32 us (SF6 at 500 kHz: 128 us)
+            airTime = ( quarters * ( ts >> 5 ) + 124 ) / 125;
         }
         break;
     }
@@ -0,0 +1,153 @@
+/*
+Description: Host test of the LoRa time on air of the SX1272 driver
+
+    Runs SX1272GetTimeOnAir( ) of ../sx1272.c against the floating point formula
+    it replaced, for every spreading factor, bandwidth, coding rate, low datarate
+    optimisation, CRC and header mode, over a set of preamble lengths and every
+    pktLen 0..255. It also checks the shift that gives the symbol time against
+    2^SF / BW computed from the bandwidth in Hz.
+    The driver is linked as it is, the board functions it calls are stubbed below.
+    See readme.txt for the build line.
+*/
+#include <stdio.h>
+#include <math.h>
+#include "board.h"
+#include "radio.h"
+#include "sx1272.h"
+#include "sx1272-board.h"
+
+/*!
+ * Preamble lengths the time on air is checked with
+ */
+static const uint16_t PreambleLens[] = { 0, 5, 6, 8, 10, 12, 16, 100, 1000, 65535 };
+
+/*!
+ * Bandwidth in Hz for the Bandwidth setting of the driver ( 0: 125 kHz, 1: 250 kHz, 2: 500 kHz )
+ */
+static const uint32_t BandwidthHz[] = { 125000, 250000, 500000 };
+
+/*
+ * Board functions the driver calls, the time on air needs none of them
+ */
+void DelayMs( uint32_t ms ) { }
+void GpioInit( Gpio_t *obj, PinNames pin, PinModes mode, PinConfigs config, PinTypes type, uint32_t value ) { }
+void GpioWrite( Gpio_t *obj, uint32_t value ) { }
+uint16_t SpiInOut( Spi_t *obj, uint16_t outData ) { return 0; }
+void TimerInit( TimerEvent_t *obj, void ( *callback )( void ) ) { }
+void TimerStart( TimerEvent_t *obj ) { }
+void TimerStop( TimerEvent_t *obj ) { }
+void TimerSetValue( TimerEvent_t *obj, uint32_t value ) { }
+void SX1272IoIrqInit( DioIrqHandler **irqHandlers ) { }
+uint8_t SX1272GetPaSelect( uint32_t channel ) { return 0; }
+void SX1272SetAntSwLowPower( bool status ) { }
+void SX1272SetAntSw( uint8_t rxTx ) { }
+void memcpy1( uint8_t *dst, const uint8_t *src, uint16_t size ) { }
+
+/*!
+ * \brief   The floating point formula of the driver before it was made integer only. The
+ *          numerator is signed here: the old driver computed it unsigned and returned about
+ *          458 s for the small implicit header packets that have no payload symbols.
+ *
+ * \retval  time on air in ms
+ */
+static uint32_t TimeOnAirDouble( uint8_t pktLen )
+{
+    double bw = BandwidthHz[SX1272.Settings.LoRa.Bandwidth];
+
+    // Symbol rate : time for one symbol (secs)
+    double rs = bw / ( 1 << SX1272.Settings.LoRa.Datarate );
+    double ts = 1 / rs;
+    // time of preamble
+    double tPreamble = ( SX1272.Settings.LoRa.PreambleLen + 4.25 ) * ts;
+    // Symbol length of payload and time
+    double tmp = ceil( ( 8 * pktLen - 4 * ( int32_t )SX1272.Settings.LoRa.Datarate +
+                         28 + 16 * SX1272.Settings.LoRa.CrcOn -
+                         ( SX1272.Settings.LoRa.FixLen ? 20 : 0 ) ) /
+                         ( double )( 4 * SX1272.Settings.LoRa.Datarate -
+                         ( ( SX1272.Settings.LoRa.LowDatarateOptimize > 0 ) ? 2 : 0 ) ) ) *
+                         ( SX1272.Settings.LoRa.Coderate + 4 );
+    double nPayload = 8 + ( ( tmp > 0 ) ? tmp : 0 );
+    double tPayload = nPayload * ts;
+    // Time on air
+    double tOnAir = tPreamble + tPayload;
+    // return ms secs
+    return floor( tOnAir * 1e3 + 0.999 );
+}
+
+/*!
+ * \brief   Checks the symbol time of the driver: 1 << ( SF + 3 - Bandwidth ) us must be
+ *          2^SF / BW, and a multiple of 32 us for the ( ts >> 5 ) of the driver
+ *
+ * \retval  number of mismatches
+ */
+static uint32_t CheckSymbolTime( void )
+{
+    uint32_t errors = 0;
+    uint32_t sf, bw;
+
+    for( sf = 6; sf <= 12; sf++ )
+    {
+        for( bw = 0; bw <= 2; bw++ )
+        {
+            uint32_t shift = ( uint32_t )1 << ( sf + 3 - bw );
+            uint64_t exact = ( ( uint64_t )1000000 << sf ) / BandwidthHz[bw];
+
+            if( ( ( ( uint64_t )1000000 << sf ) % BandwidthHz[bw] ) != 0 || shift != exact || ( shift & 31 ) != 0 )
+            {
+                printf( "SF%u BW%u: symbol time %u us, expected %llu us\n", sf, bw, shift, ( unsigned long long )exact );
+                errors++;
+            }
+        }
+    }
+    return errors;
+}
+
+int main( void )
+{
+    uint32_t cases = 0, errors = 0, negative = 0;
+    uint32_t sf, bw, cr, ldro, crc, fixLen, p;
+    int pktLen;
+
+    errors += CheckSymbolTime( );
+
+    for( sf = 6; sf <= 12; sf++ )
+    for( bw = 0; bw <= 2; bw++ )
+    for( cr = 1; cr <= 4; cr++ )
+    for( ldro = 0; ldro <= 1; ldro++ )
+    for( crc = 0; crc <= 1; crc++ )
+    for( fixLen = 0; fixLen <= 1; fixLen++ )
+    for( p = 0; p < sizeof( PreambleLens ) / sizeof( PreambleLens[0] ); p++ )
+    {
+        SX1272.Settings.LoRa.Datarate = sf;
+        SX1272.Settings.LoRa.Bandwidth = bw;
+        SX1272.Settings.LoRa.Coderate = cr;
+        SX1272.Settings.LoRa.LowDatarateOptimize = ldro;
+        SX1272.Settings.LoRa.CrcOn = crc;
+        SX1272.Settings.LoRa.FixLen = fixLen;
+        SX1272.Settings.LoRa.PreambleLen = PreambleLens[p];
+
+        for( pktLen = 0; pktLen <= 255; pktLen++ )
+        {
+            uint32_t expected = TimeOnAirDouble( pktLen );
+            uint32_t airTime = SX1272GetTimeOnAir( MODEM_LORA, pktLen );
+
+            cases++;
+            // Small implicit header packets: no payload symbols besides the 8 of the header
+            if( 8 * pktLen - 4 * ( int32_t )sf + 28 + 16 * ( int32_t )crc - ( fixLen ? 20 : 0 ) < 0 )
+            {
+                negative++;
+            }
+            if( airTime != expected )
+            {
+                if( errors++ < 10 )
+                {
+                    printf( "SF%u BW%u CR%u LDRO%u CRC%u FixLen%u preamble %u pktLen %d: %u ms, expected %u ms\n",
+                            sf, bw, cr, ldro, crc, fixLen, PreambleLens[p], pktLen, airTime, expected );
+                }
+            }
+        }
+    }
+
+    printf( "%u cases (%u without payload symbols), %u errors\n", cases, negative, errors );
+    return errors != 0;
+}